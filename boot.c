@@ -0,0 +1,103 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/io.h>
+#include <avr/pgmspace.h>
+
+#include "print.h"
+#include "led.h"
+#include "host.h"
+#include "boot.h"
+
+/*
+ * Boot-time profiling and deferred initialization.
+ *
+ * TMK's timer is initialized only after USB enumeration
+ * (PJRC's main() waits for it before calling keyboard_init()),
+ * so the boot phases are timed with Timer 3 instead.
+ * It is started by matrix_setup() with a prescaler of 1024 (64us per tick,
+ * wrapping after 4.2s) and handed over to the buzzer once booting is done.
+ * Nothing before matrix_setup() can be timed, but that is only
+ * the MCU's startup delay.
+ *
+ * Everything that is not needed for reporting keys (the PWM timers,
+ * the LEDs and thereby the buzzer) is set up only by the first
+ * boot_task(), after the first scan.
+ */
+
+/** Duration of a Timer 3 tick (us) */
+#define BOOT_TICK_US (1024*1000000UL/F_CPU)
+
+static uint16_t boot_ticks[BOOT_MAX];
+static bool boot_done = false;
+
+static const char boot_phase_names[BOOT_MAX][6] PROGMEM = {
+    [BOOT_SETUP] = "setup",
+    [BOOT_USB] = "usb",
+    [BOOT_INIT] = "init",
+    [BOOT_SCAN] = "scan",
+    [BOOT_READY] = "ready"
+};
+
+/** Record the time of a boot phase */
+void boot_mark(enum boot_phase phase)
+{
+    if (phase == BOOT_SETUP) {
+        TCCR3A = 0;
+        TCNT3 = 0;
+        TCCR3B = 0b101;
+    }
+
+    boot_ticks[phase] = TCNT3;
+}
+
+/**
+ * Finish booting.
+ *
+ * This is called from the keyboard loop and returns immediately
+ * after the first call.
+ */
+void boot_task(void)
+{
+    if (boot_done)
+        return;
+    boot_done = true;
+
+    boot_mark(BOOT_READY);
+    /* release Timer 3 for the buzzer */
+    TCCR3B = 0;
+
+    /* this also configures all LED pins and brings them into defined states */
+    led_set(host_keyboard_leds());
+
+    boot_print();
+}
+
+/** Print the boot phase timestamps (us since matrix_setup()) */
+void boot_print(void)
+{
+    print("\nboot:");
+    for (uint8_t i = 0; i < BOOT_MAX; i++) {
+        print(" ");
+        print_P(boot_phase_names[i]);
+        xprintf("=%lu", (uint32_t)(boot_ticks[i] - boot_ticks[BOOT_SETUP]) * BOOT_TICK_US);
+    }
+    print(" us\n");
+}
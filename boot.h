@@ -0,0 +1,43 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef BOOT_H
+#define BOOT_H
+
+#include <stdint.h>
+
+/** Boot phases in chronological order */
+enum boot_phase {
+    /** matrix_setup(), right after reset */
+    BOOT_SETUP = 0,
+    /** matrix_init(), after USB enumeration */
+    BOOT_USB,
+    /** End of matrix_init() */
+    BOOT_INIT,
+    /** End of the first matrix scan */
+    BOOT_SCAN,
+    /** First keyboard loop hook, ie. the first report was sent if keys were down */
+    BOOT_READY,
+    /** not a real phase */
+    BOOT_MAX
+};
+
+void boot_mark(enum boot_phase phase);
+void boot_task(void);
+void boot_print(void);
+
+#endif
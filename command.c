@@ -18,27 +18,46 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <stdbool.h>
 #include <stdint.h>
 
+#include <avr/pgmspace.h>
+
 #include "debug.h"
+#include "log.h"
 #include "led.h"
 #include "host.h"
 #include "keycode.h"
 #include "keyclick.h"
 #include "pwm.h"
 #include "song.h"
+#include "trace.h"
+#include "debounce.h"
+#include "settings.h"
+#include "macro.h"
+#include "profile.h"
+#include "mouse.h"
+#include "pcm.h"
+#include "keymap_overlay.h"
+#include "isrprof.h"
+#include "boot.h"
 #include "command.h"
 
 enum keyclick_mode keyclick_mode = KEYCLICK_OFF;
 
+/** Demo text, also useful for measuring macro throughput */
+static const char command_banner[] PROGMEM =
+    "Robotron A5120 - SCP 1700\n"
+    "login: the quick brown fox jumps over the lazy dog 0123456789\n"
+    "THE QUICK BROWN FOX JUMPS OVER THE LAZY DOG !\"#$%&'()*+,-./:;<=>?@[\\]^_`{|}~\n";
+
 bool command_extra(uint8_t code)
 {
     switch (code) {
         //case KC_AUDIO_MUTE:
         case KC_SPACE:
             keyclick_mode = (keyclick_mode+1) % KEYCLICK_MAX;
-            dprintf("new keyclick mode: %u\n", keyclick_mode);
+            LOG(COMMAND, INFO, "new keyclick mode: %u\n", keyclick_mode);
+            settings_set(SETTING_KEYCLICK_MODE, keyclick_mode);
             /* FIXME: Perhaps do this in matrix_scan() */
-            keyclick_solenoid_set(false);
-            pwm_pd0_set_tone(0);
+            keyclick_stop();
             /* update the keyclick mode LED */
             led_set(host_keyboard_leds());
             return true;
@@ -49,11 +68,107 @@ bool command_extra(uint8_t code)
          * It should therefore be safe to repurpose them.
          */
         case KC_F1:
-            song_play_ruinen();
+            if (profile.flags & PROFILE_ANIMATION)
+                song_play_ruinen();
             return true;
         case KC_F2:
-            song_play_kitt();
+            if (profile.flags & PROFILE_ANIMATION)
+                song_play_kitt();
+            return true;
+
+        case KC_L:
+            profile_select((profile_get()+1) % PROFILE_MAX);
+            return true;
+
+#ifdef MOUSEKEY_ENABLE
+        case KC_A:
+            mouse_select_curve((mouse_get_curve()+1) % MOUSE_CURVE_MAX);
+            return true;
+#endif
+
+        /* adjust the brightness of the PWM-controlled LEDs */
+        case KC_UP:
+        case KC_DOWN: {
+            uint8_t brightness = settings_get(SETTING_LED_BRIGHTNESS);
+
+            if (code == KC_UP)
+                brightness = brightness > 255-16 ? 255 : brightness+16;
+            else
+                brightness = brightness < 16 ? 0 : brightness-16;
+            LOG(COMMAND, INFO, "new LED brightness: %u\n", brightness);
+            settings_set(SETTING_LED_BRIGHTNESS, brightness);
+            led_set(host_keyboard_leds());
+            return true;
+        }
+
+        /*
+         * Type text macros.
+         * The EEPROM macro is a NUL-terminated string that can be
+         * written using avrdude.
+         * T and M are taken by command_common() (timer and mouse debug).
+         */
+        case KC_Y:
+            macro_play_P(command_banner);
+            return true;
+        case KC_G:
+            macro_play_eeprom((const uint8_t *)EEPROM_MACRO_ADDR);
+            return true;
+
+        /*
+         * Tune the solenoid's pull-in time and hold duty cycle.
+         * H is taken by command_common() (help).
+         */
+        case KC_P: {
+            uint8_t pulse = settings_get(SETTING_SOLENOID_PULSE);
+            pulse = pulse >= KEYCLICK_SOLENOID_EXTENDTIME ? 1 : pulse+1;
+            LOG(COMMAND, INFO, "new solenoid pull-in time: %ums\n", pulse);
+            settings_set(SETTING_SOLENOID_PULSE, pulse);
+            return true;
+        }
+        case KC_J: {
+            uint8_t hold = settings_get(SETTING_SOLENOID_HOLD);
+            hold = hold >= 100 ? 0 : hold+10;
+            LOG(COMMAND, INFO, "new solenoid hold duty cycle: %u%%\n", hold);
+            settings_set(SETTING_SOLENOID_HOLD, hold);
+            return true;
+        }
+
+        case KC_B:
+            debounce_print();
+            return true;
+        case KC_U:
+            boot_print();
+            return true;
+
+        /*
+         * Remap keys at runtime (see keymap_overlay.c).
+         * K is taken by command_common() (keyboard debug).
+         */
+        case KC_O:
+            keymap_overlay_learn();
+            return true;
+        case KC_BSPACE:
+            keymap_overlay_clear();
+            return true;
+
+#ifdef PCM_ENABLE
+        case KC_W:
+            pcm_test();
+            return true;
+#endif
+
+#ifdef ISRPROF_ENABLE
+        case KC_I:
+            isrprof_dump();
+            return true;
+#endif
+
+#ifdef TRACE_ENABLE
+        case KC_R:
+            trace_enable = !trace_enable;
+            LOG(COMMAND, INFO, "key event trace: %u\n", trace_enable);
             return true;
+#endif
     }
 
     return false;
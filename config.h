@@ -35,8 +35,13 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 /* define if matrix has ghost */
 //#define MATRIX_HAS_GHOST
 
-/* Set 0 if debouncing isn't needed */
+/*
+ * Initial debounce window per key (ms). Set 0 if debouncing isn't needed.
+ * The windows are tuned at runtime between DEBOUNCE_MIN and DEBOUNCE_MAX.
+ */
 #define DEBOUNCE    5
+#define DEBOUNCE_MIN    2
+#define DEBOUNCE_MAX    15
 
 /* Mechanical locking support. Use KC_LCAP, KC_LNUM or KC_LSCR instead in keymap */
 #define LOCKING_SUPPORT_ENABLE
@@ -47,13 +52,24 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
  * Key combination for "magic" commands (LSHIFT+ET2+ET1).
  *
  * NOTE: This is LSHIFT+RSHIFT default.
- * We had to pick something else since we cannot current discern these keys.
+ * We had to pick something else since we cannot discern these keys:
+ * Both are wired to the same matrix position (column 15, row 7),
+ * so this is not a matter of scanning.
  * This would be possible to add support for RSHIFT with a simple hardware hack, though.
  */
 #define IS_COMMAND() ( \
     keyboard_report->mods == (MOD_BIT(KC_LSHIFT) | MOD_BIT(KC_LCTRL) | MOD_BIT(KC_RALT)) \
 )
 
+/*
+ * EEPROM layout.
+ * 0x000-0x03F is reserved for TMK's eeconfig.
+ */
+#define EEPROM_DEBOUNCE_ADDR    0x040   /* 128 bytes, see debounce.c */
+#define EEPROM_KEYMAP_ADDR      0x0C0   /* 128 bytes, see keymap_overlay.c */
+#define EEPROM_MACRO_ADDR       0x400   /* 1024 bytes, see command.c */
+#define EEPROM_SETTINGS_ADDR    0x800   /* 2048 bytes, see settings.c */
+
 /*
  * Feature disable options
  *  These options are also useful to firmware size reduction.
@@ -67,7 +83,8 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 
 /* disable action features */
 //#define NO_ACTION_LAYER
-//#define NO_ACTION_TAPPING
+/* replaced by dualrole.c, which does not delay the following keys */
+#define NO_ACTION_TAPPING
 //#define NO_ACTION_ONESHOT
 //#define NO_ACTION_MACRO
 //#define NO_ACTION_FUNCTION
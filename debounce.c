@@ -0,0 +1,265 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/eeprom.h>
+
+#include "print.h"
+#include "timer.h"
+#include "trace.h"
+#include "matrix.h"
+#include "debounce.h"
+
+/*
+ * NOTE: The "Betriebsdokumentation" mentions that the keyboard matrix
+ * must not change for two scan cycles.
+ * Instead, a key must not change for its debounce window (in ms).
+ *
+ * Since the switches age differently, every key has got its own
+ * debounce window, which starts out as DEBOUNCE (5ms in config.h)
+ * and is tuned at runtime between DEBOUNCE_MIN (2ms) and DEBOUNCE_MAX (15ms)
+ * (see debounce_tune()).
+ * 2ms has been shown to be sufficient for healthy switches.
+ * It is still possible for keypresses to be instable but this has only
+ * been observed with a poor power source.
+ * The defaults below apply only if config.h does not define them.
+ */
+#ifndef DEBOUNCE
+#   define DEBOUNCE	2
+#endif
+#ifndef DEBOUNCE_MIN
+#   define DEBOUNCE_MIN	2
+#endif
+#ifndef DEBOUNCE_MAX
+#   define DEBOUNCE_MAX	15
+#endif
+
+/** Safety margin added to the measured bounce duration (ms) */
+#define DEBOUNCE_MARGIN		1
+/**
+ * Two commits of the same key within this time (ms) are considered chatter,
+ * ie. the debounce window was too short.
+ * Nobody types that fast.
+ */
+#define DEBOUNCE_CHATTER	20
+/** Number of commits with short bounces before shrinking a window by 1ms */
+#define DEBOUNCE_SHRINK		32
+/** Minimum time between saving tuned windows to EEPROM (ms) */
+#define DEBOUNCE_SAVE_INTERVAL	(10*60*1000UL)
+
+/** Debounce window per key (ms) */
+static uint8_t debounce_window[MATRIX_ROWS][MATRIX_COLS];
+/** Keys with raw edges since their last commit */
+static matrix_row_t debounce_active[MATRIX_ROWS];
+/** Time of the first raw edge since the last commit */
+static uint16_t debounce_first_edge[MATRIX_ROWS][MATRIX_COLS];
+/** Time of the last raw edge */
+static uint16_t debounce_last_edge[MATRIX_ROWS][MATRIX_COLS];
+/** Time of the last commit */
+static uint16_t debounce_last_commit[MATRIX_ROWS][MATRIX_COLS];
+/** Number of commits since the window was last changed */
+static uint8_t debounce_stable[MATRIX_ROWS][MATRIX_COLS];
+/** Fixed debounce window for all keys (ms) or 0 */
+static uint8_t debounce_fixed = 0;
+
+static bool debounce_dirty = false;
+static uint32_t debounce_save_time = 0;
+/** Next byte to save to EEPROM or 0xFF if not saving */
+static uint8_t debounce_save_pos = 0xFF;
+
+void debounce_init(void)
+{
+    uint16_t now = timer_read();
+
+    eeprom_read_block(debounce_window, (const void *)EEPROM_DEBOUNCE_ADDR,
+                      sizeof(debounce_window));
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            /* this also initializes erased (0xFF) EEPROM */
+            if (debounce_window[row][col] < DEBOUNCE_MIN ||
+                debounce_window[row][col] > DEBOUNCE_MAX)
+                debounce_window[row][col] = DEBOUNCE;
+
+            /*
+             * The first commit after booting (eg. of keys held at boot time)
+             * must not be mistaken for chatter.
+             */
+            debounce_last_commit[row][col] = now - DEBOUNCE_CHATTER;
+        }
+    }
+}
+
+/**
+ * Use a fixed debounce window for all keys instead of the tuned windows.
+ *
+ * @param window Debounce window (ms) or 0 to switch back to
+ *     adaptive debouncing.
+ */
+void debounce_set_fixed(uint8_t window)
+{
+    debounce_fixed = window;
+}
+
+/**
+ * Register a raw edge.
+ * This must be called by the matrix scan whenever a key's raw state changed.
+ *
+ * @return Whether this is the first edge since the key was last
+ *     committed or filtered, ie. not a bounce.
+ */
+bool debounce_edge(uint8_t row, uint8_t col, uint16_t now)
+{
+    bool first = !(debounce_active[row] & (1 << col));
+
+    if (first) {
+        debounce_active[row] |= (1 << col);
+        debounce_first_edge[row][col] = now;
+    }
+
+    debounce_last_edge[row][col] = now;
+    return first;
+}
+
+/**
+ * Adapt a key's debounce window after it was committed.
+ *
+ * The bounce duration is the time between the first and the last
+ * raw edge of a key before it was committed.
+ * The window is enlarged immediately if a bounce came close to it,
+ * but shrinks only slowly after many short bounces.
+ * This keeps the latency of healthy keys low while worn keys that
+ * bounce longer or only from time to time do not chatter.
+ * If a key chatters nevertheless (its debounce window was too short to cover
+ * a gap between bounces), its window is enlarged by 2ms.
+ */
+static void debounce_tune(uint8_t row, uint8_t col, uint16_t now)
+{
+    uint8_t *window = &debounce_window[row][col];
+    uint16_t bounce = debounce_last_edge[row][col] - debounce_first_edge[row][col];
+    uint8_t new_window = *window;
+
+    if ((uint16_t)(now - debounce_last_commit[row][col]) < DEBOUNCE_CHATTER) {
+        new_window = *window+2;
+    } else if (bounce+DEBOUNCE_MARGIN >= *window) {
+        new_window = bounce+DEBOUNCE_MARGIN > DEBOUNCE_MAX
+                        ? DEBOUNCE_MAX : bounce+DEBOUNCE_MARGIN;
+        /* don't shrink for a while */
+        debounce_stable[row][col] = 0;
+    } else if (++debounce_stable[row][col] >= DEBOUNCE_SHRINK) {
+        new_window = *window-1;
+    }
+
+    debounce_last_commit[row][col] = now;
+
+    if (new_window < DEBOUNCE_MIN)
+        new_window = DEBOUNCE_MIN;
+    else if (new_window > DEBOUNCE_MAX)
+        new_window = DEBOUNCE_MAX;
+    if (new_window == *window)
+        return;
+
+    *window = new_window;
+    debounce_stable[row][col] = 0;
+    debounce_dirty = true;
+}
+
+/**
+ * Commit all keys of a column that have been stable for their
+ * debounce windows.
+ *
+ * @param debounced The debounced matrix state to update.
+ * @param raw The raw matrix state.
+ * @param col The column to process.
+ * @param now Current time in ms.
+ * @return Bit mask of rows whose debounced state changed.
+ */
+uint8_t debounce_col(matrix_row_t debounced[], const matrix_row_t raw[],
+                     uint8_t col, uint16_t now)
+{
+    uint8_t changed = 0;
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        uint8_t window = debounce_fixed ? : debounce_window[row][col];
+
+        if (!(debounce_active[row] & (1 << col)) ||
+            (uint16_t)(now - debounce_last_edge[row][col]) < window)
+            continue;
+
+        debounce_active[row] &= ~(1 << col);
+
+        if ((debounced[row] ^ raw[row]) & (1 << col)) {
+            debounced[row] ^= (1 << col);
+            changed |= (1 << row);
+            if (!debounce_fixed)
+                debounce_tune(row, col, now);
+            trace_event(row, col, debounced[row] & (1 << col), TRACE_COMMIT);
+        } else {
+            /* the key bounced back, ie. a glitch */
+            trace_event(row, col, debounced[row] & (1 << col), TRACE_FILTERED);
+        }
+    }
+
+    return changed;
+}
+
+/**
+ * Persist tuned debounce windows.
+ *
+ * This is called from the keyboard loop and writes at most one byte at a time
+ * without waiting for the EEPROM, so that scanning is not delayed.
+ */
+void debounce_task(void)
+{
+    if (debounce_save_pos == 0xFF) {
+        if (!debounce_dirty || timer_elapsed32(debounce_save_time) < DEBOUNCE_SAVE_INTERVAL)
+            return;
+        debounce_dirty = false;
+        debounce_save_time = timer_read32();
+        debounce_save_pos = 0;
+    }
+
+    for (; debounce_save_pos < sizeof(debounce_window); debounce_save_pos++) {
+        uint8_t *addr = (uint8_t *)EEPROM_DEBOUNCE_ADDR + debounce_save_pos;
+        uint8_t value = ((uint8_t *)debounce_window)[debounce_save_pos];
+
+        if (!eeprom_is_ready())
+            return;
+        if (eeprom_read_byte(addr) != value) {
+            eeprom_write_byte(addr, value);
+            debounce_save_pos++;
+            return;
+        }
+    }
+
+    debounce_save_pos = 0xFF;
+}
+
+void debounce_print(void)
+{
+    print("\nr/c 0123456789ABCDEF (debounce ms)\n");
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        print_hex8(row); print(": ");
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            uint8_t window = debounce_window[row][col];
+            xprintf("%c", window < 10 ? '0'+window : 'A'+window-10);
+        }
+        print("\n");
+    }
+}
@@ -0,0 +1,34 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef DEBOUNCE_H
+#define DEBOUNCE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+void debounce_init(void);
+bool debounce_edge(uint8_t row, uint8_t col, uint16_t now);
+uint8_t debounce_col(matrix_row_t debounced[], const matrix_row_t raw[],
+                     uint8_t col, uint16_t now);
+void debounce_set_fixed(uint8_t window);
+void debounce_task(void);
+void debounce_print(void);
+
+#endif
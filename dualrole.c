@@ -0,0 +1,197 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "action.h"
+#include "action_code.h"
+#include "action_layer.h"
+#include "action_util.h"
+#include "keycode.h"
+#include "hook.h"
+#include "timer.h"
+#include "tick.h"
+#include "log.h"
+#include "keymap_overlay.h"
+#include "dualrole.h"
+
+/*
+ * Dual-role (tap-hold) keys.
+ *
+ * Keys mapped to ACTION_MODS_TAP_KEY() act as modifiers while held and
+ * send their key when tapped.
+ * TMK's own resolver (action_tapping.c) buffers all key events following
+ * a dual-role key for up to TAPPING_TERM, which delays typing.
+ * It is therefore disabled (NO_ACTION_TAPPING) and replaced by this one:
+ *
+ * - A dual-role key is considered held as soon as another key is pressed
+ *   while it is down. Its modifiers are registered right before the
+ *   other key is processed, so the other key is never delayed.
+ * - A dual-role key that is down for TAPPING_TERM without any other key
+ *   being pressed is considered held as well, so it also modifies
+ *   mouse clicks and wheel turns.
+ *   This does not delay any other key either.
+ * - Otherwise it is a tap, which is decided when it is released.
+ * - All other keys are passed through immediately.
+ */
+
+/** Maximum number of dual-role keys down at the same time */
+#define DUALROLE_KEYS 2
+
+#ifndef TAPPING_TERM
+/** Time after which a dual-role key down alone is considered held (ms) */
+#define TAPPING_TERM 200
+#endif
+
+enum dualrole_state {
+    DUALROLE_IDLE = 0,
+    /** Pressed, but neither tap nor hold yet */
+    DUALROLE_PENDING,
+    /** Modifiers registered */
+    DUALROLE_HOLD
+};
+
+static struct dualrole_key {
+    enum dualrole_state state;
+    keypos_t key;
+    /** 8-bit modifier mask */
+    uint8_t mods;
+    /** Key code to send when tapped */
+    uint8_t tap;
+    /** Time of the press (ms) */
+    uint16_t time;
+} dualrole_keys[DUALROLE_KEYS];
+
+static struct dualrole_key *dualrole_find(keypos_t key)
+{
+    for (uint8_t i = 0; i < DUALROLE_KEYS; i++) {
+        struct dualrole_key *dual = &dualrole_keys[i];
+
+        if (dual->state != DUALROLE_IDLE &&
+            dual->key.row == key.row && dual->key.col == key.col)
+            return dual;
+    }
+
+    return NULL;
+}
+
+/**
+ * Register the modifiers of pending dual-role keys.
+ *
+ * @param term Minimum time the keys must have been down (ms).
+ * @return Whether any keys were decided as held.
+ */
+static bool dualrole_hold(uint16_t term)
+{
+    bool resolved = false;
+
+    for (uint8_t i = 0; i < DUALROLE_KEYS; i++) {
+        struct dualrole_key *dual = &dualrole_keys[i];
+
+        if (dual->state != DUALROLE_PENDING || timer_elapsed(dual->time) < term)
+            continue;
+
+        add_mods(dual->mods);
+        dual->state = DUALROLE_HOLD;
+        resolved = true;
+        LOG(DUALROLE, DEBUG, "Dual-role %02X held after %u ms\n",
+            dual->key.row << 4 | dual->key.col, timer_elapsed(dual->time));
+    }
+
+    if (resolved)
+        send_keyboard_report();
+    return resolved;
+}
+
+static bool dualrole_press(keyevent_t event)
+{
+    action_t action = layer_switch_get_action(event.key);
+
+    if ((action.kind.id != ACT_LMODS_TAP && action.kind.id != ACT_RMODS_TAP) ||
+        !IS_KEY(action.key.code))
+        return false;
+
+    for (uint8_t i = 0; i < DUALROLE_KEYS; i++) {
+        struct dualrole_key *dual = &dualrole_keys[i];
+
+        if (dual->state != DUALROLE_IDLE)
+            continue;
+
+        dual->state = DUALROLE_PENDING;
+        dual->key = event.key;
+        dual->mods = action.kind.id == ACT_LMODS_TAP ? action.key.mods
+                                                      : action.key.mods << 4;
+        dual->tap = action.key.code;
+        dual->time = timer_read();
+        break;
+    }
+
+    /* if all slots are in use, the key is ignored */
+    return true;
+}
+
+static void dualrole_release(struct dualrole_key *dual)
+{
+    if (dual->state == DUALROLE_PENDING) {
+        LOG(DUALROLE, DEBUG, "Dual-role %02X tapped after %u ms\n",
+            dual->key.row << 4 | dual->key.col, timer_elapsed(dual->time));
+        register_code(dual->tap);
+        unregister_code(dual->tap);
+    } else {
+        del_mods(dual->mods);
+        send_keyboard_report();
+    }
+
+    dual->state = DUALROLE_IDLE;
+}
+
+bool hook_process_action(keyrecord_t *record)
+{
+    keyevent_t event = record->event;
+
+    /* remapping keys takes precedence */
+    if (keymap_overlay_process(record))
+        return true;
+
+    if (!event.pressed) {
+        struct dualrole_key *dual = dualrole_find(event.key);
+
+        if (!dual)
+            return false;
+        dualrole_release(dual);
+        return true;
+    }
+
+    /*
+     * Any key press decides pending dual-role keys as held.
+     * The only latency this adds to the key press is the additional report.
+     */
+    uint32_t start = tick_read();
+    if (dualrole_hold(0))
+        LOG(DUALROLE, DEBUG, "Key %02X delayed by %u us\n",
+            event.key.row << 4 | event.key.col, (tick_read() - start)*TICK_US);
+
+    return dualrole_press(event);
+}
+
+/** Decide dual-role keys that are down alone for TAPPING_TERM as held */
+void dualrole_task(void)
+{
+    dualrole_hold(TAPPING_TERM);
+}
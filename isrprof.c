@@ -0,0 +1,120 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "print.h"
+#include "isrprof.h"
+
+/*
+ * Interrupt profiler.
+ *
+ * Every profiled ISR reports the CPU cycles elapsed since its triggering
+ * event on entry (the latency) and exit (latency plus duration).
+ * This is measured with the vector's own timer, which is running anyway
+ * and resolves single cycles for Timer 1 and 3 (64 cycles for Timer 0).
+ *
+ * The nesting depth counts profiled ISRs only.
+ * TMK's ISRs (USB and the millisecond timer) cannot be instrumented
+ * without patching tmk_core, but whenever they delay or interrupt
+ * a profiled ISR, this shows up as latency or duration.
+ */
+
+struct isrprof_stats {
+    uint32_t count;
+    uint32_t latency_sum;
+    uint32_t duration_sum;
+    uint16_t latency_max;
+    uint16_t duration_max;
+    /** Maximum nesting depth, 1 if never nested */
+    uint8_t depth_max;
+};
+
+static struct isrprof_stats isrprof_stats[ISRPROF_MAX];
+/** Number of profiled ISRs currently executing */
+static uint8_t isrprof_depth = 0;
+
+static const char isrprof_names[ISRPROF_MAX][13] PROGMEM = {
+    [ISRPROF_TIMER0_COMPB] = "TIMER0_COMPB",
+    [ISRPROF_TIMER1_OVF] = "TIMER1_OVF",
+    [ISRPROF_TIMER3_COMPA] = "TIMER3_COMPA",
+    [ISRPROF_TIMER3_COMPB] = "TIMER3_COMPB"
+};
+
+/*
+ * NOTE: These may be called with interrupts enabled (ISR_NOBLOCK).
+ */
+void isrprof_enter(enum isrprof_vector vector, uint16_t latency)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        struct isrprof_stats *stats = &isrprof_stats[vector];
+
+        isrprof_depth++;
+        if (isrprof_depth > stats->depth_max)
+            stats->depth_max = isrprof_depth;
+
+        stats->count++;
+        stats->latency_sum += latency;
+        if (latency > stats->latency_max)
+            stats->latency_max = latency;
+    }
+}
+
+void isrprof_exit(enum isrprof_vector vector, uint16_t duration)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        struct isrprof_stats *stats = &isrprof_stats[vector];
+
+        isrprof_depth--;
+
+        stats->duration_sum += duration;
+        if (duration > stats->duration_max)
+            stats->duration_max = duration;
+    }
+}
+
+/**
+ * Print the statistics collected since the last dump to the console
+ * and reset them.
+ * All times are in CPU cycles (16 per us).
+ */
+void isrprof_dump(void)
+{
+    struct isrprof_stats stats[ISRPROF_MAX];
+
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        memcpy(stats, isrprof_stats, sizeof(stats));
+        memset(isrprof_stats, 0, sizeof(isrprof_stats));
+    }
+
+    print("\nvector            count lat.max lat.avg dur.max dur.avg depth (cycles)\n");
+    for (uint8_t i = 0; i < ISRPROF_MAX; i++) {
+        uint32_t count = stats[i].count ? : 1;
+
+        print_P(isrprof_names[i]);
+        for (uint8_t len = strlen_P(isrprof_names[i]); len < sizeof(isrprof_names[i]); len++)
+            print(" ");
+        xprintf("%10lu %7u %7lu %7u %7lu %5u\n", stats[i].count,
+                stats[i].latency_max, stats[i].latency_sum / count,
+                stats[i].duration_max, stats[i].duration_sum / count,
+                stats[i].depth_max);
+    }
+}
@@ -0,0 +1,64 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef ISRPROF_H
+#define ISRPROF_H
+
+#include <stdint.h>
+
+/** Profiled interrupt vectors */
+enum isrprof_vector {
+    ISRPROF_TIMER0_COMPB = 0,
+    ISRPROF_TIMER1_OVF,
+    ISRPROF_TIMER3_COMPA,
+    ISRPROF_TIMER3_COMPB,
+    /** not a real vector */
+    ISRPROF_MAX
+};
+
+#ifdef ISRPROF_ENABLE
+
+/**
+ * Profile an interrupt service routine.
+ *
+ * ISRPROF_ENTER() must be the first statement of the ISR and ISRPROF_EXIT()
+ * must be executed before every return.
+ *
+ * @param VECTOR The vector being profiled (enum isrprof_vector).
+ * @param NOW Expression evaluating to the CPU cycles elapsed since the
+ *     vector's event (eg. the compare match), usually derived from the
+ *     vector's own timer.
+ *     At entry, this is the latency of the interrupt.
+ */
+#define ISRPROF_ENTER(VECTOR, NOW) \
+    uint16_t isrprof_entry = (NOW); \
+    isrprof_enter(VECTOR, isrprof_entry)
+#define ISRPROF_EXIT(VECTOR, NOW) \
+    isrprof_exit(VECTOR, (uint16_t)(NOW) - isrprof_entry)
+
+void isrprof_enter(enum isrprof_vector vector, uint16_t latency);
+void isrprof_exit(enum isrprof_vector vector, uint16_t duration);
+void isrprof_dump(void);
+
+#else
+
+#define ISRPROF_ENTER(VECTOR, NOW)
+#define ISRPROF_EXIT(VECTOR, NOW)
+
+#endif
+
+#endif
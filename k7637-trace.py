@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+# ./k7637-trace.py [-o trace.csv] [--capture FILE [--scan-us N]] [hid_listen.log]
+#
+# Decodes the binary key event trace (see trace.c) from hid_listen output
+# into CSV and prints latency statistics.
+# With --capture, the raw edges are also written as a raw matrix capture
+# that can be replayed by replay/k7637-replay.c.
+# Enable TRACE_ENABLE in the Makefile and toggle tracing with LSHIFT+ET1+ET2+R.
+#
+# Example: hid_listen | tee session.log; ./k7637-trace.py -o session.csv session.log
+import argparse
+import collections
+import csv
+import sys
+
+TICK_US = 4
+OUTCOMES = ("raw", "commit", "filtered", "lost")
+MATRIX_ROWS = 8
+MATRIX_COLS = 16
+# "security key" bits (rows 0-2 of the last column) are sensed as pressed
+# when no key is inserted
+REST_STATE = [1 << (MATRIX_COLS-1) if row < 3 else 0 for row in range(MATRIX_ROWS)]
+
+class Capture:
+	"""Raw matrix capture (see replay/k7637-replay.c for the format)"""
+
+	def __init__(self):
+		self.state = list(REST_STATE)
+		self.scans = [(0, tuple(self.state))]
+		self.last_marker = None
+		self.min_interval = None
+
+	def edge(self, row, col, pressed):
+		if pressed:
+			self.state[row] |= 1 << col
+		else:
+			self.state[row] &= ~(1 << col)
+
+	def scan(self, time):
+		if self.last_marker is not None:
+			interval = time - self.last_marker
+			if interval and (self.min_interval is None or interval < self.min_interval):
+				self.min_interval = interval
+		self.last_marker = time
+		if tuple(self.state) != self.scans[-1][1]:
+			self.scans.append((time, tuple(self.state)))
+
+	def finish(self, time):
+		# edges of the last scan, if its marker has not been drained
+		if tuple(self.state) != self.scans[-1][1]:
+			self.scans.append((time, tuple(self.state)))
+
+	def write(self, out, scan_us):
+		print("# K7637 raw matrix capture", file=out)
+		print("# scan_us %u" % scan_us, file=out)
+		for time, state in self.scans:
+			print("%u %s" % (time, " ".join("%04X" % row for row in state)), file=out)
+
+def records(lines):
+	for line in lines:
+		line = line.strip()
+		if not line.startswith("T:"):
+			continue
+		data = line[2:]
+		for i in range(0, len(data) - 7, 8):
+			try:
+				raw = bytes.fromhex(data[i:i+8])
+			except ValueError:
+				break
+			yield raw[0], raw[1] >> 6, raw[2] << 8 | raw[3]
+
+def main():
+	parser = argparse.ArgumentParser(description="Decode K7637 key event traces")
+	parser.add_argument("input", nargs="?", type=argparse.FileType("r"), default=sys.stdin)
+	parser.add_argument("-o", "--output", type=argparse.FileType("w"), default=sys.stdout,
+	                    help="CSV output (default: stdout)")
+	parser.add_argument("--capture", type=argparse.FileType("w"),
+	                    help="Write raw matrix capture")
+	parser.add_argument("--scan-us", type=int,
+	                    help="Scan period of the capture (default: shortest interval between scans)")
+	args = parser.parse_args()
+
+	writer = csv.writer(args.output)
+	writer.writerow(("time_us", "row", "col", "edge", "outcome", "gap"))
+
+	time = 0
+	counts = collections.Counter()
+	lost = 0
+	# first raw edge of a key since its last commit
+	first_edge = {}
+	edges = collections.Counter()
+	latencies = []
+	bounces = []
+	capture = Capture()
+
+	for key, outcome, delta in records(args.input):
+		time += delta * TICK_US
+		if outcome == 3 and key == 0:
+			# end of a matrix scan with raw edges
+			capture.scan(time)
+			continue
+
+		counts[OUTCOMES[outcome]] += 1
+		# saturated deltas mean that the gap is at least this long
+		gap = ">=" if delta == 0xFFFF else ""
+		if outcome == 3:
+			lost += key
+			writer.writerow((time, "", "", "", "lost", gap))
+			continue
+
+		pos = (key >> 4 & 0x7, key & 0xF)
+		edge = "press" if key & 0x80 else "release"
+		writer.writerow((time, pos[0], pos[1], edge, OUTCOMES[outcome], gap))
+
+		if outcome == 0:
+			capture.edge(pos[0], pos[1], key & 0x80)
+			first_edge.setdefault(pos, time)
+			edges[pos] += 1
+		elif pos in first_edge:
+			if outcome == 1:
+				latencies.append(time - first_edge[pos])
+				bounces.append(edges[pos])
+			del first_edge[pos]
+			del edges[pos]
+
+	out = sys.stderr
+	print("events: " + ", ".join("%s=%u" % (o, counts[o]) for o in OUTCOMES), file=out)
+	if lost:
+		print("WARNING: %u events lost (buffer overflow)" % lost, file=out)
+	if latencies:
+		latencies.sort()
+		print("debounce latency (first edge to commit): min=%uus median=%uus max=%uus" %
+		      (latencies[0], latencies[len(latencies)//2], latencies[-1]), file=out)
+		print("raw edges per commit: mean=%.2f max=%u" %
+		      (sum(bounces)/len(bounces), max(bounces)), file=out)
+
+	if args.capture:
+		scan_us = args.scan_us or capture.min_interval
+		if not scan_us:
+			sys.exit("Cannot determine the scan period, use --scan-us")
+		if lost:
+			print("WARNING: capture is incomplete", file=out)
+		capture.finish(time)
+		capture.write(args.capture, scan_us)
+		print("capture: %u scans, scan period %uus" % (len(capture.scans), scan_us), file=out)
+
+if __name__ == "__main__":
+	main()
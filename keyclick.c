@@ -0,0 +1,137 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "led.h"
+#include "host.h"
+#include "pwm.h"
+#include "settings.h"
+#include "profile.h"
+#include "keyclick.h"
+
+/** Whether the keyclick is currently active (see keyclick_start()) */
+static bool keyclick_active = false;
+/** Time the keyclick was started */
+static uint16_t keyclick_time;
+
+/**
+ * Give the buzzer back to the Kana LED.
+ *
+ * led_set() sets the Kana tone only when the Kana LED changes,
+ * so it must be restored after the buzzer was used for a keyclick.
+ */
+static void keyclick_buzzer_release(void)
+{
+    if (host_keyboard_leds() & (1 << USB_LED_KANA))
+        pwm_pd0_set_note(KEYCLICK_KANA_NOTE, KEYCLICK_KANA_FINE);
+    else
+        pwm_pd0_set_note(PWM_NOTE_OFF, 0);
+}
+
+/**
+ * Trigger keyclick whenever a key press has been committed
+ * (or on its first raw edge with EAGER_KEYCLICK_ENABLE).
+ *
+ * When using the solenoid, it is activated and deactivated after
+ * KEYCLICK_SOLENOID_EXTENDTIME.
+ * It is pulled in with full power and held with a lower duty cycle
+ * for the remaining time (see pwm_pb3_solenoid_pulse()).
+ * I tried to test a different solenoid mode - where the solenoid is
+ * active as long as the key is pressed - but this is not how IBM
+ * Beamspring solenoids worked (see Model F Technical Reference, p.182)
+ * and it would also draw too much power.
+ *
+ * When using the buzzer, a short KEYCLICK_BUZZER_TIME beep is played
+ * every time a new key is pressed.
+ *
+ * We consciously do not _delay_ms() here since that would delay
+ * key event delivery.
+ */
+void keyclick_start(uint16_t now)
+{
+    if (!(profile.flags & PROFILE_KEYCLICK))
+        return;
+
+    switch (keyclick_mode) {
+        case KEYCLICK_SOLENOID: {
+            uint8_t pulse = settings_get(SETTING_SOLENOID_PULSE);
+            if (pulse > KEYCLICK_SOLENOID_EXTENDTIME)
+                pulse = KEYCLICK_SOLENOID_EXTENDTIME;
+            pwm_pb3_solenoid_pulse(pulse, KEYCLICK_SOLENOID_EXTENDTIME - pulse,
+                                   settings_get(SETTING_SOLENOID_HOLD));
+            break;
+        }
+
+        case KEYCLICK_BUZZER:
+            pwm_pd0_set_note(72, 221); /* 550 Hz */
+            break;
+
+        default:
+            return;
+    }
+
+    keyclick_active = true;
+    keyclick_time = now;
+}
+
+/**
+ * Perform the delayed action depending on the keyclick mode (see above).
+ *
+ * Both the solenoid and buzzer are turned off after a short while.
+ * If the Kana LED is on, its tone is restored instead (see led_set()).
+ * This is polled on every scan, which makes sure we do not delay any
+ * key delivery.
+ * The solenoid is therefore released at most one scan after
+ * KEYCLICK_SOLENOID_EXTENDTIME, no matter how often it was retriggered.
+ */
+void keyclick_poll(uint16_t now)
+{
+    if (!keyclick_active)
+        return;
+
+    switch (keyclick_mode) {
+        case KEYCLICK_SOLENOID:
+            if ((uint16_t)(now - keyclick_time) < KEYCLICK_SOLENOID_EXTENDTIME)
+                return;
+            pwm_pb3_solenoid_off();
+            break;
+
+        case KEYCLICK_BUZZER:
+            if ((uint16_t)(now - keyclick_time) < KEYCLICK_BUZZER_TIME)
+                return;
+            keyclick_buzzer_release();
+            break;
+
+        default:
+            /* the keyclick mode was changed and has turned off everything */
+            break;
+    }
+
+    keyclick_active = false;
+}
+
+/**
+ * Stop any keyclick immediately, eg. when the keyclick mode is changed.
+ */
+void keyclick_stop(void)
+{
+    pwm_pb3_solenoid_off();
+    keyclick_buzzer_release();
+    keyclick_active = false;
+}
@@ -18,13 +18,15 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #ifndef KEYCLICK_H
 #define KEYCLICK_H
 
-#include <stdbool.h>
+#include <stdint.h>
 
-#include <avr/io.h>
-
-#define KEYCLICK_SOLENOID_EXTENDTIME 15 /* ms */
+#define KEYCLICK_SOLENOID_EXTENDTIME 15 /* ms, including the pull-in time */
 #define KEYCLICK_BUZZER_TIME 50 /* ms */
 
+/** Tone of the Kana LED, which shares the buzzer with the keyclick (2200 Hz) */
+#define KEYCLICK_KANA_NOTE 96
+#define KEYCLICK_KANA_FINE 221
+
 enum keyclick_mode {
     KEYCLICK_OFF = 0,
     KEYCLICK_SOLENOID,
@@ -35,13 +37,8 @@ enum keyclick_mode {
 
 extern enum keyclick_mode keyclick_mode;
 
-static inline void
-keyclick_solenoid_set(bool state)
-{
-	if (state)
-		PORTB |= (1 << PB3);
-	else
-	        PORTB &= ~(1 << PB3);
-}
+void keyclick_start(uint16_t now);
+void keyclick_poll(uint16_t now);
+void keyclick_stop(void);
 
 #endif
@@ -0,0 +1,133 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/pgmspace.h>
+
+#include "action_code.h"
+#include "action_layer.h"
+#include "keymap.h"
+#include "unimap.h"
+#include "hook.h"
+#include "matrix.h"
+#include "keymap_overlay.h"
+#include "mouse.h"
+#include "keymap_cache.h"
+
+extern const action_t actionmaps[][UNIMAP_ROWS][UNIMAP_COLS];
+extern const uint8_t unimap_trans[MATRIX_ROWS][MATRIX_COLS];
+
+/**
+ * Resolved actions of the current layer stack by matrix position.
+ *
+ * Without this, every key event costs two flash reads (unimap_trans and
+ * actionmaps) per active layer.
+ * Since the layer stack changes rarely compared to key events, we resolve
+ * it for all 128 keys at once and only have to read RAM afterwards.
+ */
+static action_t keymap_cache[MATRIX_ROWS][MATRIX_COLS];
+/** Layer the cache was resolved for, ie. the topmost active layer */
+static uint8_t keymap_cache_layer = 0;
+static bool keymap_cache_valid = false;
+
+/**
+ * Look up an action in the keymap overlay or in flash.
+ * The latter is what Unimap's default action_for_key() does.
+ */
+static action_t keymap_lookup(uint8_t layer, uint8_t row, uint8_t col)
+{
+    action_t action;
+
+    if (keymap_overlay_has(row, col) && keymap_overlay_lookup(layer, row, col, &action))
+        return action;
+
+    uint8_t unimap_pos = pgm_read_byte(&unimap_trans[row][col]);
+
+    if (unimap_pos == UNIMAP_NO)
+        return (action_t){.code = ACTION_NO};
+
+    return (action_t)pgm_read_word(&actionmaps[layer][(unimap_pos >> 4) & 0x7][unimap_pos & 0x0F]);
+}
+
+static void keymap_cache_update(void)
+{
+    uint32_t layers = layer_state | default_layer_state;
+    /* active layers, topmost first */
+    uint8_t stack[32], stack_size = 0;
+
+    for (int8_t i = 31; i >= 0; i--) {
+        if (layers & (1UL << i))
+            stack[stack_size++] = i;
+    }
+    /* layer_switch_get_action() falls back to layer 0 */
+    if (!stack_size || stack[stack_size-1] != 0)
+        stack[stack_size++] = 0;
+
+    keymap_cache_layer = stack[0];
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            action_t action = {.code = ACTION_TRANSPARENT};
+
+            for (uint8_t i = 0; i < stack_size && action.code == ACTION_TRANSPARENT; i++)
+                action = keymap_lookup(stack[i], row, col);
+
+            keymap_cache[row][col] = action;
+        }
+    }
+
+    keymap_cache_valid = true;
+}
+
+/*
+ * NOTE: layer_switch_get_action() always asks for the topmost active layer
+ * first, so this is the only lookup per key event as long as the resolved
+ * action is not transparent.
+ * The remaining layers are only consulted if all of them are transparent
+ * for the given key.
+ */
+action_t action_for_key(uint8_t layer, keypos_t key)
+{
+    if (!keymap_cache_valid)
+        keymap_cache_update();
+
+    if (layer == keymap_cache_layer)
+        return keymap_cache[key.row][key.col];
+
+    return keymap_lookup(layer, key.row, key.col);
+}
+
+/** Resolve the cache again on the next lookup (eg. after remapping keys) */
+void keymap_cache_invalidate(void)
+{
+    keymap_cache_valid = false;
+}
+
+void hook_layer_change(uint32_t state)
+{
+    (void)state;
+    keymap_cache_update();
+    mouse_clear();
+}
+
+void hook_default_layer_change(uint32_t state)
+{
+    (void)state;
+    keymap_cache_update();
+}
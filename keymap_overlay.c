@@ -0,0 +1,273 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+
+#include "action.h"
+#include "action_layer.h"
+#include "util.h"
+#include "log.h"
+#include "keymap_cache.h"
+#include "keymap_overlay.h"
+
+/*
+ * Sparse keymap overlay in EEPROM.
+ *
+ * Every entry overrides the action of one matrix position on one layer
+ * of the actionmaps in unimap_00.c, so keys can be remapped at runtime
+ * without reflashing.
+ * The entries are loaded into RAM at boot time and applied when the
+ * keymap cache is resolved (see keymap_cache.c).
+ * keymap_overlay_map records which positions are remapped at all,
+ * so keys that are not remapped cost only a bit test.
+ *
+ * Keys are remapped with LSHIFT+ET1+ET2+O (see keymap_overlay_learn())
+ * or by writing the EEPROM directly (eg. with avrdude).
+ * Every entry is 4 bytes: The layer, the matrix position (row << 4 | col)
+ * and the 16-bit action code (little endian).
+ * Free entries have got a layer of 0xFF, so erased EEPROM is an empty overlay.
+ */
+
+/** Number of entries */
+#define KEYMAP_OVERLAY_SIZE 32
+/** Layer of free entries */
+#define KEYMAP_OVERLAY_FREE 0xFF
+
+struct keymap_overlay_entry {
+    uint8_t layer;
+    /** Matrix position (row << 4 | col) */
+    uint8_t pos;
+    action_t action;
+};
+
+static struct keymap_overlay_entry keymap_overlay[KEYMAP_OVERLAY_SIZE];
+
+matrix_row_t keymap_overlay_map[MATRIX_ROWS];
+
+static bool keymap_overlay_dirty = false;
+/** Next byte to save to EEPROM or 0xFF if not saving */
+static uint8_t keymap_overlay_save_pos = 0xFF;
+
+enum keymap_learn_state {
+    KEYMAP_LEARN_IDLE = 0,
+    /** Waiting for the key to remap */
+    KEYMAP_LEARN_TARGET,
+    /** Waiting for the key whose action to copy */
+    KEYMAP_LEARN_SOURCE
+};
+
+static enum keymap_learn_state keymap_learn_state = KEYMAP_LEARN_IDLE;
+static keypos_t keymap_learn_target;
+static uint8_t keymap_learn_layer;
+/** Keys whose presses were consumed by the learn sequence */
+static matrix_row_t keymap_learn_consumed[MATRIX_ROWS];
+
+static void keymap_overlay_changed(void)
+{
+    memset(keymap_overlay_map, 0, sizeof(keymap_overlay_map));
+
+    for (uint8_t i = 0; i < KEYMAP_OVERLAY_SIZE; i++) {
+        const struct keymap_overlay_entry *entry = &keymap_overlay[i];
+
+        if (entry->layer != KEYMAP_OVERLAY_FREE)
+            keymap_overlay_map[entry->pos >> 4] |= (matrix_row_t)1 << (entry->pos & 0x0F);
+    }
+
+    keymap_cache_invalidate();
+}
+
+void keymap_overlay_init(void)
+{
+    eeprom_read_block(keymap_overlay, (const void *)EEPROM_KEYMAP_ADDR,
+                      sizeof(keymap_overlay));
+
+    for (uint8_t i = 0; i < KEYMAP_OVERLAY_SIZE; i++) {
+        if ((keymap_overlay[i].pos >> 4) >= MATRIX_ROWS)
+            keymap_overlay[i].layer = KEYMAP_OVERLAY_FREE;
+    }
+
+    keymap_overlay_changed();
+}
+
+/**
+ * Look up an overridden action.
+ *
+ * This should only be called if keymap_overlay_has() is true
+ * for the position.
+ *
+ * @return Whether the position is remapped on this layer.
+ */
+bool keymap_overlay_lookup(uint8_t layer, uint8_t row, uint8_t col, action_t *action)
+{
+    uint8_t pos = row << 4 | col;
+
+    for (uint8_t i = 0; i < KEYMAP_OVERLAY_SIZE; i++) {
+        const struct keymap_overlay_entry *entry = &keymap_overlay[i];
+
+        if (entry->layer == layer && entry->pos == pos) {
+            *action = entry->action;
+            return true;
+        }
+    }
+
+    return false;
+}
+
+/**
+ * Find the entry of a position or a free one.
+ *
+ * @return The entry or NULL if the overlay is full.
+ */
+static struct keymap_overlay_entry *keymap_overlay_find(uint8_t layer, uint8_t pos)
+{
+    struct keymap_overlay_entry *found = NULL;
+
+    for (uint8_t i = 0; i < KEYMAP_OVERLAY_SIZE; i++) {
+        struct keymap_overlay_entry *entry = &keymap_overlay[i];
+
+        if (entry->layer == layer && entry->pos == pos)
+            return entry;
+        if (!found && entry->layer == KEYMAP_OVERLAY_FREE)
+            found = entry;
+    }
+
+    return found;
+}
+
+/**
+ * Start remapping a key.
+ *
+ * The next key pressed is remapped on the topmost active layer.
+ * It gets the current action of the key pressed after it.
+ * Pressing the same key twice restores its original action.
+ */
+void keymap_overlay_learn(void)
+{
+    keymap_learn_state = KEYMAP_LEARN_TARGET;
+    LOG(COMMAND, INFO, "Remap: press the key to remap\n");
+}
+
+/** Restore the original keymap */
+void keymap_overlay_clear(void)
+{
+    for (uint8_t i = 0; i < KEYMAP_OVERLAY_SIZE; i++)
+        keymap_overlay[i].layer = KEYMAP_OVERLAY_FREE;
+
+    keymap_overlay_changed();
+    keymap_overlay_dirty = true;
+    LOG(COMMAND, INFO, "Remap: cleared\n");
+}
+
+static void keymap_overlay_remap(keypos_t source)
+{
+    uint8_t pos = keymap_learn_target.row << 4 | keymap_learn_target.col;
+    struct keymap_overlay_entry *entry = keymap_overlay_find(keymap_learn_layer, pos);
+
+    if (!entry) {
+        LOG(COMMAND, ERROR, "Remap: overlay full\n");
+        return;
+    }
+
+    if (source.row == keymap_learn_target.row && source.col == keymap_learn_target.col) {
+        entry->layer = KEYMAP_OVERLAY_FREE;
+        LOG(COMMAND, INFO, "Remap: %02X restored\n", pos);
+    } else {
+        entry->layer = keymap_learn_layer;
+        entry->pos = pos;
+        entry->action = layer_switch_get_action(source);
+        LOG(COMMAND, INFO, "Remap: %02X on layer %u is now %04X\n",
+            pos, keymap_learn_layer, entry->action.code);
+    }
+
+    keymap_overlay_changed();
+    keymap_overlay_dirty = true;
+}
+
+/**
+ * Process key events during the learn sequence.
+ *
+ * @return Whether the event was consumed.
+ */
+bool keymap_overlay_process(keyrecord_t *record)
+{
+    keyevent_t event = record->event;
+    matrix_row_t bit = (matrix_row_t)1 << event.key.col;
+
+    if (!event.pressed) {
+        /* the releases of consumed presses must not be processed either */
+        if (!(keymap_learn_consumed[event.key.row] & bit))
+            return false;
+        keymap_learn_consumed[event.key.row] &= ~bit;
+        return true;
+    }
+
+    switch (keymap_learn_state) {
+    case KEYMAP_LEARN_IDLE:
+        return false;
+
+    case KEYMAP_LEARN_TARGET:
+        keymap_learn_target = event.key;
+        keymap_learn_layer = biton32(layer_state | default_layer_state);
+        keymap_learn_state = KEYMAP_LEARN_SOURCE;
+        LOG(COMMAND, INFO, "Remap: press the key with the new action\n");
+        break;
+
+    case KEYMAP_LEARN_SOURCE:
+        keymap_overlay_remap(event.key);
+        keymap_learn_state = KEYMAP_LEARN_IDLE;
+        break;
+    }
+
+    keymap_learn_consumed[event.key.row] |= bit;
+    return true;
+}
+
+/**
+ * Persist the overlay.
+ *
+ * This is called from the keyboard loop and writes at most one byte at a time
+ * without waiting for the EEPROM, so that scanning is not delayed.
+ */
+void keymap_overlay_task(void)
+{
+    if (keymap_overlay_save_pos == 0xFF) {
+        if (!keymap_overlay_dirty)
+            return;
+        keymap_overlay_dirty = false;
+        keymap_overlay_save_pos = 0;
+    }
+
+    for (; keymap_overlay_save_pos < sizeof(keymap_overlay); keymap_overlay_save_pos++) {
+        uint8_t *addr = (uint8_t *)EEPROM_KEYMAP_ADDR + keymap_overlay_save_pos;
+        uint8_t value = ((uint8_t *)keymap_overlay)[keymap_overlay_save_pos];
+
+        if (!eeprom_is_ready())
+            return;
+        if (eeprom_read_byte(addr) != value) {
+            eeprom_write_byte(addr, value);
+            keymap_overlay_save_pos++;
+            return;
+        }
+    }
+
+    keymap_overlay_save_pos = 0xFF;
+}
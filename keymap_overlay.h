@@ -0,0 +1,47 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef KEYMAP_OVERLAY_H
+#define KEYMAP_OVERLAY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "action.h"
+#include "matrix.h"
+
+/** Matrix positions with at least one overridden action (on any layer) */
+extern matrix_row_t keymap_overlay_map[MATRIX_ROWS];
+
+/**
+ * Check whether a matrix position is remapped on any layer.
+ * This is all the lookup costs for keys that are not remapped.
+ */
+static inline bool
+keymap_overlay_has(uint8_t row, uint8_t col)
+{
+    return keymap_overlay_map[row] & ((matrix_row_t)1 << col);
+}
+
+void keymap_overlay_init(void);
+bool keymap_overlay_lookup(uint8_t layer, uint8_t row, uint8_t col, action_t *action);
+void keymap_overlay_learn(void);
+void keymap_overlay_clear(void);
+bool keymap_overlay_process(keyrecord_t *record);
+void keymap_overlay_task(void);
+
+#endif
@@ -20,13 +20,31 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <avr/io.h>
 
 #include "debug.h"
+#include "log.h"
+#include "host.h"
+#include "suspend.h"
+#include "hook.h"
 #include "keyclick.h"
 #include "led.h"
 #include "pwm.h"
+#include "settings.h"
+#include "tick.h"
 
+/** USB LED state of the last led_set() or 0xFFFF if unknown */
+static uint16_t led_last = 0xFFFF;
+
+/**
+ * Set all LEDs.
+ *
+ * This is called on every host LED report, but also when the keyclick mode
+ * or brightness changed.
+ * Only outputs whose value actually changed are touched (see pwm.c),
+ * so the other LEDs do not flicker and the buzzer is not restarted.
+ */
 void led_set(uint8_t usb_led)
 {
-    dprintf("Set keyboard LEDs: 0x%02X\n", usb_led);
+    uint32_t start = tick_read();
+    uint8_t brightness = settings_get(SETTING_LED_BRIGHTNESS);
 
     /*
      * All LEDs and the buzzer are output pins obviously, even for PWM operation
@@ -41,13 +59,13 @@ void led_set(uint8_t usb_led)
         PORTD |= (1 << PD3);
 
     /* 1st LED on first row (G00). */
-    pwm_pb5_set_led(usb_led & (1 << USB_LED_NUM_LOCK) ? 255 : 0);
+    pwm_pb5_set_led(usb_led & (1 << USB_LED_NUM_LOCK) ? brightness : 0);
 
     /* 2nd LED on first row (G01): Highlight keyclick mode. */
-    pwm_pd1_set_led(keyclick_mode*255/(KEYCLICK_MAX-1));
+    pwm_pd1_set_led(keyclick_mode*brightness/(KEYCLICK_MAX-1));
 
     /* 3rd LED on the first row (G02) */
-    pwm_pb7_set_led(usb_led & (1 << USB_LED_COMPOSE) ? 255 : 0);
+    pwm_pb7_set_led(usb_led & (1 << USB_LED_COMPOSE) ? brightness : 0);
 
     /*
      * 4th LED (G03) are currently not triggerable via USB.
@@ -56,7 +74,7 @@ void led_set(uint8_t usb_led)
     pwm_pb4_set_led(0);
 
     /* 5th LED on the first row (G04) */
-    pwm_pb6_set_led(usb_led & (1 << USB_LED_SCROLL_LOCK) ? 255 : 0);
+    pwm_pb6_set_led(usb_led & (1 << USB_LED_SCROLL_LOCK) ? brightness : 0);
 
     /*
      * 6th LED on the first row (G53).
@@ -66,12 +84,62 @@ void led_set(uint8_t usb_led)
      *
      * The original firmware also had the error display on G53
      * (cf. Betriebsdokumentation).
+     * A buzzer keyclick restores the tone when it is done (see keyclick_poll()).
      */
-    if (usb_led & (1 << USB_LED_KANA)) {
-        PORTD &= ~(1 << PD2);
-        pwm_pd0_set_tone(2200);
-    } else {
-        PORTD |= (1 << PD2);
-        pwm_pd0_set_tone(0);
+    if (led_last > 0xFF || ((usb_led ^ led_last) & (1 << USB_LED_KANA))) {
+        if (usb_led & (1 << USB_LED_KANA)) {
+            PORTD &= ~(1 << PD2);
+            pwm_pd0_set_note(KEYCLICK_KANA_NOTE, KEYCLICK_KANA_FINE);
+        } else {
+            PORTD |= (1 << PD2);
+            pwm_pd0_set_note(PWM_NOTE_OFF, 0);
+        }
     }
+    led_last = usb_led;
+
+    LOG(LED, DEBUG, "Set keyboard LEDs: 0x%02X (%u cycles)\n", usb_led,
+        (uint16_t)((tick_read() - start) * (F_CPU/1000000UL) * TICK_US));
+}
+
+#ifdef BREATHING_LED_ENABLE
+
+/*
+ * The MCU sleeps in idle mode (SUSPEND_MODE_IDLE) while suspended.
+ * This is the deepest sleep mode that keeps the I/O clock and therefore
+ * Timer 1 running, which is required for a breathing LED.
+ * All unused peripherals are powered down, though.
+ *
+ * LUFA calls these hooks, while with PJRC, matrix_scan() polls the
+ * `suspend` flag and calls them itself.
+ */
+void hook_usb_suspend_entry(void)
+{
+    if (pwm_breathing)
+        return;
+
+    /* turn off everything but G00 */
+    PORTD |= (1 << PD3) | (1 << PD2);
+    led_last = 0xFFFF;
+    pwm_pd0_set_note(PWM_NOTE_OFF, 0);
+    pwm_pb3_solenoid_off();
+    for (uint8_t led = 1; led < 5; led++)
+        pwm_set_led(led, 0);
+
+    PRR0 |= (1 << PRTWI) | (1 << PRTIM2) | (1 << PRSPI) | (1 << PRADC);
+    PRR1 |= (1 << PRTIM3) | (1 << PRUSART1);
+
+    pwm_breathing_start(settings_get(SETTING_LED_BRIGHTNESS));
+}
+
+void hook_usb_wakeup(void)
+{
+    PRR0 &= ~((1 << PRTWI) | (1 << PRTIM2) | (1 << PRSPI) | (1 << PRADC));
+    PRR1 &= ~((1 << PRTIM3) | (1 << PRUSART1));
+
+    pwm_breathing_stop();
+
+    suspend_wakeup_init();
+    led_set(host_keyboard_leds());
 }
+
+#endif
@@ -0,0 +1,73 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+
+#include "print.h"
+#include "log.h"
+
+struct log_entry {
+    /** Format string in flash */
+    const char *fmt;
+    uint16_t args[4];
+};
+
+/** Number of entries in the ring buffer (power of 2) */
+#define LOG_SIZE 16
+
+static struct log_entry log_buffer[LOG_SIZE];
+static uint8_t log_head = 0, log_tail = 0;
+static uint8_t log_lost = 0;
+
+void log_push(const char *fmt, uint16_t a, uint16_t b, uint16_t c, uint16_t d)
+{
+    if ((uint8_t)(log_head - log_tail) >= LOG_SIZE) {
+        if (log_lost < 0xFF)
+            log_lost++;
+        return;
+    }
+
+    struct log_entry *entry = log_buffer + log_head % LOG_SIZE;
+    entry->fmt = fmt;
+    entry->args[0] = a;
+    entry->args[1] = b;
+    entry->args[2] = c;
+    entry->args[3] = d;
+    log_head++;
+}
+
+/**
+ * Write the oldest log message to the console.
+ *
+ * This writes at most one message per call, so that
+ * key event delivery is not delayed noticeably.
+ */
+void log_task(void)
+{
+    if (log_head == log_tail)
+        return;
+
+    const struct log_entry *entry = log_buffer + log_tail % LOG_SIZE;
+    __xprintf(entry->fmt, entry->args[0], entry->args[1],
+              entry->args[2], entry->args[3]);
+    log_tail++;
+
+    if (log_lost && log_head == log_tail) {
+        xprintf("(%u log messages lost)\n", log_lost);
+        log_lost = 0;
+    }
+}
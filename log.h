@@ -0,0 +1,86 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef LOG_H
+#define LOG_H
+
+#include <stdint.h>
+
+#include <avr/pgmspace.h>
+
+#include "debug.h"
+
+/*
+ * Deferred debug logging.
+ *
+ * LOG() only stores a pointer to the format string (in flash) and up to
+ * four 16-bit arguments in a ring buffer, which takes a few cycles.
+ * The messages are formatted and written to the console by log_task()
+ * from the keyboard loop, so logging does not delay scanning or
+ * key event delivery.
+ * Like dprintf(), nothing is logged unless debugging is enabled
+ * (LSHIFT+ET1+ET2+D).
+ *
+ * Every subsystem has got its own log level, which can be overridden
+ * in config.h.
+ * Messages above the subsystem's level compile to nothing.
+ */
+#define LOG_LEVEL_NONE  0
+#define LOG_LEVEL_ERROR 1
+#define LOG_LEVEL_INFO  2
+#define LOG_LEVEL_DEBUG 3
+
+#ifndef LOG_LEVEL_MATRIX
+#   define LOG_LEVEL_MATRIX     LOG_LEVEL_INFO
+#endif
+#ifndef LOG_LEVEL_LED
+#   define LOG_LEVEL_LED        LOG_LEVEL_DEBUG
+#endif
+#ifndef LOG_LEVEL_COMMAND
+#   define LOG_LEVEL_COMMAND    LOG_LEVEL_INFO
+#endif
+#ifndef LOG_LEVEL_SETTINGS
+#   define LOG_LEVEL_SETTINGS   LOG_LEVEL_INFO
+#endif
+#ifndef LOG_LEVEL_MACRO
+#   define LOG_LEVEL_MACRO      LOG_LEVEL_INFO
+#endif
+#ifndef LOG_LEVEL_DUALROLE
+#   define LOG_LEVEL_DUALROLE   LOG_LEVEL_DEBUG
+#endif
+
+/**
+ * Log a message.
+ *
+ * @param SUBSYS Subsystem (eg. MATRIX).
+ * @param LEVEL Message level (eg. INFO).
+ * @param FMT printf-like format string literal.
+ *     All arguments are passed as 16-bit integers.
+ */
+#define LOG(SUBSYS, LEVEL, ...) \
+    LOG_(LOG_LEVEL_##SUBSYS >= LOG_LEVEL_##LEVEL, __VA_ARGS__, 0, 0, 0, 0)
+#define LOG_(ENABLED, FMT, A, B, C, D, ...) do { \
+    if ((ENABLED) && debug_enable) { \
+        static const char log_fmt[] PROGMEM = FMT; \
+        log_push(log_fmt, (A), (B), (C), (D)); \
+    } \
+} while (0)
+
+void log_push(const char *fmt, uint16_t a, uint16_t b, uint16_t c, uint16_t d);
+void log_task(void);
+
+#endif
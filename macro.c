@@ -0,0 +1,238 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+
+#include "debug.h"
+#include "log.h"
+#include "timer.h"
+#include "host.h"
+#include "report.h"
+#include "keycode.h"
+#include "action_util.h"
+#include "macro.h"
+
+/*
+ * Text macros are typed by sending our own keyboard reports.
+ *
+ * With NKRO, the host processes all keys of a report in ascending
+ * order of their usage IDs.
+ * Runs of characters with ascending keycodes and the same shift state
+ * can therefore be sent in a single report, eg. "abc" or "ELM".
+ * A key can only be pressed again after it has been released, though,
+ * so eg. the second "l" of "hello" requires releasing the first one
+ * in a report of its own.
+ * Without NKRO (boot protocol), one character is sent per report.
+ *
+ * At most one report is sent per keyboard loop iteration.
+ * host_keyboard_send() waits for the endpoint to become free, so the
+ * reports are paced by the host's polling interval.
+ */
+
+/** Mark shifted characters in macro_ascii */
+#define S(KC) (0x80 | (KC))
+
+/** Translation table from printable ASCII (US layout) to keycodes */
+static const uint8_t macro_ascii[] PROGMEM = {
+    /* 0x20 */
+    KC_SPACE, S(KC_1), S(KC_QUOTE), S(KC_3), S(KC_4), S(KC_5), S(KC_7), KC_QUOTE,
+    S(KC_9), S(KC_0), S(KC_8), S(KC_EQUAL), KC_COMMA, KC_MINUS, KC_DOT, KC_SLASH,
+    /* 0x30 */
+    KC_0, KC_1, KC_2, KC_3, KC_4, KC_5, KC_6, KC_7,
+    KC_8, KC_9, S(KC_SCOLON), KC_SCOLON, S(KC_COMMA), KC_EQUAL, S(KC_DOT), S(KC_SLASH),
+    /* 0x40 */
+    S(KC_2), S(KC_A), S(KC_B), S(KC_C), S(KC_D), S(KC_E), S(KC_F), S(KC_G),
+    S(KC_H), S(KC_I), S(KC_J), S(KC_K), S(KC_L), S(KC_M), S(KC_N), S(KC_O),
+    /* 0x50 */
+    S(KC_P), S(KC_Q), S(KC_R), S(KC_S), S(KC_T), S(KC_U), S(KC_V), S(KC_W),
+    S(KC_X), S(KC_Y), S(KC_Z), KC_LBRACKET, KC_BSLASH, KC_RBRACKET, S(KC_6), S(KC_MINUS),
+    /* 0x60 */
+    KC_GRAVE, KC_A, KC_B, KC_C, KC_D, KC_E, KC_F, KC_G,
+    KC_H, KC_I, KC_J, KC_K, KC_L, KC_M, KC_N, KC_O,
+    /* 0x70 */
+    KC_P, KC_Q, KC_R, KC_S, KC_T, KC_U, KC_V, KC_W,
+    KC_X, KC_Y, KC_Z, S(KC_LBRACKET), S(KC_BSLASH), S(KC_RBRACKET), S(KC_GRAVE)
+};
+
+#undef S
+
+/** Next character to type or NULL */
+static const uint8_t *macro_ptr = NULL;
+/** Whether macro_ptr points into EEPROM instead of flash */
+static bool macro_eeprom;
+
+/** Last report sent */
+static report_keyboard_t macro_report;
+
+static uint16_t macro_chars, macro_reports;
+static uint16_t macro_start;
+
+/**
+ * Translate an ASCII character to a keycode.
+ *
+ * @return Keycode with bit 7 set for shifted characters or
+ *     KC_NO for unsupported characters.
+ */
+static uint8_t macro_keycode(uint8_t c)
+{
+    switch (c) {
+        case '\t': return KC_TAB;
+        case '\n': return KC_ENTER;
+    }
+
+    return 0x20 <= c && c <= 0x7E ? pgm_read_byte(&macro_ascii[c - 0x20]) : KC_NO;
+}
+
+static bool macro_report_has(const report_keyboard_t *report, uint8_t kc)
+{
+#ifdef NKRO_ENABLE
+    if (keyboard_nkro)
+        return report->nkro.bits[kc >> 3] & (1 << (kc & 7));
+#endif
+    return report->keys[0] == kc;
+}
+
+static void macro_report_add(report_keyboard_t *report, uint8_t kc)
+{
+#ifdef NKRO_ENABLE
+    if (keyboard_nkro) {
+        report->nkro.bits[kc >> 3] |= (1 << (kc & 7));
+        return;
+    }
+#endif
+    report->keys[0] = kc;
+}
+
+static void macro_play(const uint8_t *ptr, bool eeprom)
+{
+    macro_ptr = ptr;
+    macro_eeprom = eeprom;
+    memset(&macro_report, 0, sizeof(macro_report));
+    macro_chars = macro_reports = 0;
+    macro_start = timer_read();
+}
+
+/**
+ * Type a NUL-terminated string from flash.
+ *
+ * Only printable ASCII, tabs and newlines are supported and the host
+ * is assumed to use a US keyboard layout.
+ * Playback happens asynchronously in macro_task().
+ */
+void macro_play_P(const char *str)
+{
+    macro_play((const uint8_t *)str, false);
+}
+
+/**
+ * Type a NUL-terminated string from EEPROM.
+ *
+ * @see macro_play_P
+ */
+void macro_play_eeprom(const uint8_t *addr)
+{
+    macro_play(addr, true);
+}
+
+bool macro_playing(void)
+{
+    return macro_ptr != NULL;
+}
+
+static void macro_send(report_keyboard_t *report)
+{
+    host_keyboard_send(report);
+    macro_report = *report;
+    macro_reports++;
+}
+
+/**
+ * Send the next report of the macro being played.
+ *
+ * This is called from the keyboard loop.
+ */
+void macro_task(void)
+{
+    report_keyboard_t report;
+    uint8_t count = 0, last = 0;
+
+    if (!macro_ptr)
+        return;
+
+    memset(&report, 0, sizeof(report));
+
+    for (;;) {
+        uint8_t c = macro_eeprom ? eeprom_read_byte(macro_ptr)
+                                 : pgm_read_byte(macro_ptr);
+        if (!c)
+            break;
+
+        uint8_t code = macro_keycode(c);
+        if (code == KC_NO) {
+            macro_ptr++;
+            continue;
+        }
+
+        uint8_t kc = code & 0x7F;
+        uint8_t mods = code & 0x80 ? MOD_BIT(KC_LSHIFT) : 0;
+
+        if (count && (kc <= last || mods != report.mods))
+            break;
+        if (macro_report_has(&macro_report, kc)) {
+            /* still pressed: release everything first */
+            if (!count) {
+                report.mods = mods;
+                macro_send(&report);
+                return;
+            }
+            break;
+        }
+
+        report.mods = mods;
+        macro_report_add(&report, kc);
+        macro_ptr++;
+        macro_chars++;
+        last = kc;
+        count++;
+
+#ifdef NKRO_ENABLE
+        if (!keyboard_nkro)
+#endif
+            break;
+    }
+
+    if (count) {
+        macro_send(&report);
+        return;
+    }
+
+    /* end of string */
+    macro_send(&report);
+    macro_ptr = NULL;
+    /* restore the real keyboard state */
+    send_keyboard_report();
+
+    uint16_t elapsed = timer_elapsed(macro_start);
+    LOG(MACRO, INFO, "Macro: %u chars in %u reports, %ums (%u chars/s)\n",
+            macro_chars, macro_reports, elapsed,
+            elapsed ? (uint16_t)(macro_chars*1000UL / elapsed) : 0);
+}
@@ -20,52 +20,113 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <string.h>
 
 #include <avr/io.h>
-#include <util/delay.h>
+#include <util/delay_basic.h>
+#include <avr/sleep.h>
 
 #include "print.h"
 #include "debug.h"
+#include "log.h"
 #include "timer.h"
 #include "led.h"
 #include "host.h"
 #include "pwm.h"
 #include "keyclick.h"
+#include "trace.h"
+#include "debounce.h"
+#include "security_key.h"
+#include "settings.h"
+#include "macro.h"
+#include "profile.h"
+#include "mouse.h"
+#include "pcm.h"
+#include "keymap_overlay.h"
+#include "dualrole.h"
+#include "sof_align.h"
+#include "boot.h"
+#include "hook.h"
 #include "matrix.h"
-
-/*
- * NOTE: The "Betriebsdokumentation" mentions that the keyboard matrix
- * must not change for two scan cycles.
- * The setting below actually means, it must not change for 2ms.
- * This has been shown to be sufficient.
- * It is still possible for keypresses to be instable but this has only
- * been observed with a poor power source.
- */
-#ifndef DEBOUNCE
-#   define DEBOUNCE	2
+#if defined(BREATHING_LED_ENABLE) && defined(PROTOCOL_PJRC)
+#include "usb.h"
 #endif
 
 /* matrix state(1:on, 0:off) */
 static matrix_row_t matrix[MATRIX_ROWS];
+/** debounced matrix state, ie. `matrix` without the "security key" translation */
+static matrix_row_t matrix_debounced[MATRIX_ROWS];
+/** raw matrix state */
 static matrix_row_t matrix_debouncing[MATRIX_ROWS];
 
+/** Minimum time between matrix scans during USB suspend (ms) */
+#define SUSPEND_SCAN_INTERVAL 32
+
 static void init_pins(void);
 static void select_col(uint8_t col);
 static void unselect_cols(void);
 static bool read_row(uint8_t row);
 
+void matrix_setup(void)
+{
+    boot_mark(BOOT_SETUP);
+}
+
 void matrix_init(void)
 {
+    boot_mark(BOOT_USB);
+
     /* Can still be activated with LSHIFT+ET1+ET2+D and LSHIFT+ET1+ET2+X */
     //debug_enable = true;
     //debug_matrix = true;
 
-    /* this also configures all LED pins and brings them into defined states */
-    led_set(host_keyboard_leds());
+    settings_init();
+    keyclick_mode = settings_get(SETTING_KEYCLICK_MODE);
+    if (keyclick_mode >= KEYCLICK_MAX)
+        keyclick_mode = KEYCLICK_OFF;
+    profile_init();
+    mouse_init();
 
+    /*
+     * NOTE: The LEDs (and thereby the PWM timers) are set up
+     * only after the first scan (see boot_task()).
+     */
     init_pins();
+    debounce_init();
+    keymap_overlay_init();
 
     /* initialize matrix state: all keys off */
     memset(matrix, 0, sizeof(matrix));
+    memset(matrix_debounced, 0, sizeof(matrix_debounced));
     memset(matrix_debouncing, 0, sizeof(matrix_debouncing));
+
+    boot_mark(BOOT_INIT);
+}
+
+/**
+ * Read the "security key" bits (see security_key.c).
+ *
+ * Changed bits are traced like raw edges, so that
+ * traces can be replayed including the "security key".
+ *
+ * @note The last column must be selected.
+ */
+static uint8_t security_key_read(void)
+{
+    uint8_t code = 0;
+
+    for (uint8_t i = 0; i < 3; i++) {
+        if (!read_row(i))
+            code |= (1 << i);
+    }
+
+#ifdef TRACE_ENABLE
+    static uint8_t traced = 0;
+    for (uint8_t i = 0; i < 3; i++) {
+        if ((code ^ traced) & (1 << i))
+            trace_event(i, MATRIX_COLS-1, !(code & (1 << i)), TRACE_RAW);
+    }
+    traced = code;
+#endif
+
+    return code;
 }
 
 /*
@@ -76,168 +137,197 @@ void matrix_init(void)
  */
 uint8_t matrix_scan(void)
 {
-    static uint16_t debouncing_time = 0, keyclick_time = 0;
-    /** Number of pressed keys in `matrix_debouncing` */
-    uint8_t matrix_debouncing_pressed_keys = 0;
+    static uint16_t security_key_time = 0;
+    uint16_t now = timer_read();
+    bool changed = false, pressed = false, security_changed = false;
+
+#ifdef BREATHING_LED_ENABLE
+    /*
+     * While suspended, the matrix is scanned only to check for remote wakeups,
+     * but on every breathing LED step.
+     * Scanning takes about 0.5ms, so we'd keep the CPU awake much of the time.
+     */
+    static uint16_t suspend_scan_time = 0;
+#ifdef PROTOCOL_PJRC
+    /*
+     * PJRC's USB stack does not call the suspend/wakeup hooks (see led.c).
+     * It only sets `suspend` and keeps calling suspend_power_down() and,
+     * if the host enabled remote wakeups, matrix_scan() until it is cleared.
+     * Without remote wakeups, the breathing LED therefore does not start,
+     * but the MCU still sleeps.
+     */
+    if (suspend != pwm_breathing) {
+        if (suspend)
+            hook_usb_suspend_entry();
+        else
+            hook_usb_wakeup();
+    }
+#endif
+    if (pwm_breathing) {
+        if (timer_elapsed(suspend_scan_time) < SUSPEND_SCAN_INTERVAL)
+            return 0;
+        suspend_scan_time = now;
+    }
+#endif
+
+    static uint16_t scan_time = 0;
+    if (profile.scan_interval) {
+        if ((uint16_t)(now - scan_time) < profile.scan_interval) {
+            /* the next Timer 0 or USB interrupt wakes us up again */
+            if (profile.flags & PROFILE_IDLE_SLEEP) {
+                set_sleep_mode(SLEEP_MODE_IDLE);
+                sleep_mode();
+            }
+            return 0;
+        }
+        scan_time = now;
+    } else if (sof_align_wait()) {
+        /* the scan was delayed until shortly before the next USB frame */
+        now = timer_read();
+    }
+
+    /* _delay_loop_1() takes 3 cycles per iteration */
+    uint8_t settle = profile.settle * (F_CPU/1000000UL) / 3;
+
+    /* column to continue with if the last scan was cut short */
+    static uint8_t first_col = 0;
+
+    for (uint8_t i = 0; i < MATRIX_COLS; i++) {
+        uint8_t col = (first_col + i) % MATRIX_COLS;
 
-    for (uint8_t col = 0; col < MATRIX_COLS; col++) {
         select_col(col);
         /*
          * Give the signals some time to settle.
          * This is not mentioned in the "Betriebsdokumentation"
          * but has been tested experimentally.
          * 30us is used by all the other controller firmwares as well.
+         * The time is configured by the scan profile.
+         */
+        _delay_loop_1(settle);
+
+        /*
+         * The first rows of the last column are only sampled
+         * at a low rate (see security_key_update()).
          */
-        _delay_us(30);
+        uint8_t row = 0;
+        if (col == MATRIX_COLS-1) {
+            if ((uint16_t)(now - security_key_time) >= SECURITY_KEY_INTERVAL) {
+                security_key_time = now;
+                security_changed = security_key_update(security_key_read());
+            }
+            row = SECURITY_KEY_ROWS;
+        }
 
-        for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (; row < MATRIX_ROWS; row++) {
             matrix_row_t prev_row = matrix_debouncing[row];
 
-            if (read_row(row)) {
+            if (read_row(row))
                 matrix_debouncing[row] |= (1 << col);
-                /* the "security key" bits do not count into the pressed keys */
-                if (col < MATRIX_COLS-1 || row > 3)
-                    matrix_debouncing_pressed_keys++;
-            } else {
+            else
                 matrix_debouncing[row] &= ~(1 << col);
-            }
 
-            if (matrix_debouncing[row] != prev_row)
-                debouncing_time = timer_read();
+            if (matrix_debouncing[row] == prev_row)
+                continue;
+
+            bool first = debounce_edge(row, col, now);
+            trace_event(row, col, matrix_debouncing[row] & (1 << col), TRACE_RAW);
+
+#ifdef EAGER_KEYCLICK_ENABLE
+            /*
+             * Fire the keyclick on the first raw press edge of a
+             * released key already.
+             * Bounces are not first edges, so a bouncing key cannot
+             * fire twice before it has been committed.
+             */
+            if (first && (matrix_debouncing[row] & (1 << col)) &&
+                !(matrix_debounced[row] & (1 << col)))
+                keyclick_start(now);
+#else
+            (void)first;
+#endif
         }
 
         unselect_cols();
-    }
-
-    if (debouncing_time && timer_elapsed(debouncing_time) >= DEBOUNCE) {
-        /** Number of pressed keys in `matrix` */
-        static uint8_t matrix_pressed_keys = 0;
 
         /*
-         * Trigger keyclick whenever the keyboard matrix has actually
-         * changed (ie. `debouncing_time` was set).
-         *
-         * When using the solenoid, it is activated and deactivated after
-         * KEYCLICK_SOLENOID_EXTENDTIME.
-         * I tried to test a different solenoid mode - where the solenoid is
-         * active as long as the key is pressed - but this is not how IBM
-         * Beamspring solenoids worked (see Model F Technical Reference, p.182)
-         * and it would also draw too much power.
-         *
-         * When using the buzzer, a short KEYCLICK_BUZZER_TIME beep is played
-         * every time a new key is pressed.
-         *
-         * We consciously do not _delay_ms() here since that would delay
-         * key event delivery.
+         * Every key is debounced individually (see debounce.c),
+         * so we can commit all keys of the column that have been stable
+         * long enough right after reading it.
          */
-        if (matrix_debouncing_pressed_keys > matrix_pressed_keys) {
-            switch (keyclick_mode) {
-                case KEYCLICK_SOLENOID:
-                    keyclick_solenoid_set(true);
-                    break;
-
-                case KEYCLICK_BUZZER:
-                    pwm_pd0_set_tone(550);
-                    break;
-
-                default:
-                    break;
+        uint8_t changed_rows = debounce_col(matrix_debounced, matrix_debouncing, col, now);
+        if (changed_rows) {
+            changed = true;
+
+#ifndef EAGER_KEYCLICK_ENABLE
+            for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+                if ((changed_rows & (1 << row)) && (matrix_debounced[row] & (1 << col)))
+                    pressed = true;
             }
-
-            keyclick_time = timer_read();
+#endif
         }
 
-        memcpy(matrix, matrix_debouncing, sizeof(matrix));
-        matrix_pressed_keys = matrix_debouncing_pressed_keys;
-
         /*
-         * The first 4 bits in the 15th column
-         * are sensed like ordinary keypresses but
-         * in reality represent a 3-bit "security key"
-         * (cf. Betriebsdokumentation, p.13f) with
-         * an actual resolution of 6 encoded into a special
-         * keylike device that's plugged into the keyboard.
-         * It makes no sense to map these original bits into
-         * the keyboard matrix.
-         * Instead we translate it into one of six key presses
-         * via unused fields of the keyboard matrix whenever
-         * the "security" key is removed.
-         * These pseudo-keypress are mapped to F19-F24 in unimap_trans
-         * and could be mapped at the OS level, eg. to lock up the screen.
-         * When removing the "security key", F18 is also pressed which
-         * will usually be mapped to a modifier but could also be left
-         * F18 and be used to lock up the screen, ignoring all the other
-         * pseudo-keys.
-         *
-         * FIXME: It would be more elegant to directly cause
-         * a key event to be generated, but this does not seem to be
-         * supported if we want to take the configurable keymap into account.
-         * Also, it might be more elegant to have all the pseudo-keys
-         * in a dedicated matrix row.
+         * Return the committed change immediately instead of finishing
+         * the scan first, which would add up to one full scan
+         * (16 columns with 30us settle time each) of latency.
+         * This is always done with LOWLATENCY_ENABLE and otherwise
+         * only by scan profiles with PROFILE_EARLY_COMMIT.
+         * The next scan continues with the next column, so every column
+         * is still read once per 16 columns, no matter how many
+         * changes are committed in between.
          */
-        static uint8_t last_security_key = 0;
-        uint8_t security_key = (~(matrix[0] >> (MATRIX_COLS-1)) & (1 << 0)) |
-                               (~(matrix[1] >> (MATRIX_COLS-2)) & (1 << 1)) |
-                               (~(matrix[2] >> (MATRIX_COLS-3)) & (1 << 2));
-
-        for (uint8_t i = 0; i < 4; i++)
-            matrix[i] &= ~(1 << (MATRIX_COLS-1)); /* F19-F24 */
-
-        if (last_security_key == 0 && 1 <= security_key && security_key <= 6) {
-            dprintf("Security key %u inserted\n", security_key);
-            matrix[security_key-1] |= (1 << (MATRIX_COLS-1)); /* F19-F24 */
-        } else if (1 <= last_security_key && last_security_key <= 6 && security_key == 0) {
-            dprintf("Security key %u removed\n", last_security_key);
-            matrix[0] |= (1 << 13); /* F18 */
-            matrix[last_security_key-1] |= (1 << (MATRIX_COLS-1)); /* F19-F24 */
+#ifdef LOWLATENCY_ENABLE
+        if (changed) {
+#else
+        if (changed && (profile.flags & PROFILE_EARLY_COMMIT)) {
+#endif
+            first_col = (col+1) % MATRIX_COLS;
+            break;
         }
+    }
 
-        last_security_key = security_key;
+    /* scans at a fixed interval are not aligned */
+    if (!profile.scan_interval)
+        sof_align_scan_done(changed);
+    trace_scan();
 
-        debouncing_time = 0;
-    } else {
-        /*
-         * Physically inserting or removing the "security key" should
-         * result in a keypress event immediately followed by a kreyrelease.
-         * We therefore clear the matrix slots reserved for it, so that
-         * the key press is reported only for one scan cycle.
-         */
-        matrix[0] &= ~(1 << 13); /* F18 */
-        for (uint8_t i = 0; i < 4; i++)
-            matrix[i] &= ~(1 << (MATRIX_COLS-1)); /* F19-F24 */
+    static bool scanned = false;
+    if (!scanned) {
+        scanned = true;
+        boot_mark(BOOT_SCAN);
     }
 
-    /*
-     * This is responsible for performing a delayed action depending
-     * on the keyclick mode (see above).
-     * Both the solenoid and buzzer are turned off after a short while.
-     * Polling here makes sure we do not delay any key delivery.
-     */
-    if (keyclick_time) {
-        switch (keyclick_mode) {
-            case KEYCLICK_SOLENOID:
-                if (timer_elapsed(keyclick_time) < KEYCLICK_SOLENOID_EXTENDTIME)
-                    break;
-                keyclick_solenoid_set(false);
-                keyclick_time = 0;
-                break;
-
-            case KEYCLICK_BUZZER:
-                if (timer_elapsed(keyclick_time) < KEYCLICK_BUZZER_TIME ||
-                    (host_keyboard_leds() & (1 << USB_LED_KANA)))
-                    break;
-                pwm_pd0_set_tone(0);
-                keyclick_time = 0;
-                break;
-
-            default:
-                break;
-        }
+    if (pressed)
+        keyclick_start(now);
+
+    if (changed || security_changed) {
+        /* this also releases all pseudo-keys */
+        memcpy(matrix, matrix_debounced, sizeof(matrix));
+        if (security_changed)
+            security_key_decode(matrix);
+    } else {
+        security_key_release(matrix);
     }
 
+    keyclick_poll(now);
+
     return 1;
 }
 
+void hook_keyboard_loop(void)
+{
+    boot_task();
+    debounce_task();
+    settings_task();
+    keymap_overlay_task();
+    dualrole_task();
+    macro_task();
+    mouse_task();
+    pcm_task();
+    trace_task();
+    log_task();
+}
+
 inline
 matrix_row_t matrix_get_row(uint8_t row)
 {
@@ -282,12 +372,15 @@ static void init_pins(void)
     DDRD  |= 0b10000000;
 
     /*
-     * PF3 == A15 must be LOW since otherwise some NAND gates (IC13) will interfere with D0-3
-     * (half of the matrix rows).
-     * We might also draw this to GND by cable or destroy IC13.
-     * The latter might even save some power.
+     * Column 15: PF3 == A15
      *
-     * FIXME: A15 must actually be triggered for some of the modifiers!
+     * A15 must be LOW while strobing the other columns since otherwise
+     * some NAND gates (IC13) will interfere with D0-3 (half of the matrix rows).
+     * It is strobed like any other column, though, since the
+     * remaining rows carry ordinary keys (eg. LSHIFT).
+     * While A15 is HIGH, IC13 drives the "security key" bits onto D0-3.
+     * These rows are therefore masked from the ordinary scan
+     * (see SECURITY_KEY_ROWS).
      */
     DDRF  |= 0b00001000;
     PORTF &= ~0b00001000;
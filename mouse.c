@@ -0,0 +1,257 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/pgmspace.h>
+
+#include "action.h"
+#include "report.h"
+#include "host.h"
+#include "timer.h"
+#include "log.h"
+#include "settings.h"
+#include "mouse.h"
+
+/*
+ * Smooth mouse keys.
+ *
+ * TMK's mousekey.c moves the pointer by whole pixels in coarse steps
+ * at its MOUSEKEY_INTERVAL.
+ * Instead, we keep the pointer speed in pixels per ms (8.8 fixed point)
+ * and report the accumulated movement every millisecond, ie. at up to 1kHz.
+ * The fractional part is carried over to the next report, so even slow
+ * speeds move smoothly and no movement is lost to rounding.
+ *
+ * At most one report is sent per millisecond and keyboard loop iteration
+ * (after the keyboard events of that iteration have been processed),
+ * so keyboard reports are never starved.
+ */
+
+/** Time between the points of an acceleration curve (ms) */
+#define MOUSE_CURVE_STEP    64
+#define MOUSE_CURVE_POINTS  16
+/** Time the last point of an acceleration curve is reached (ms) */
+#define MOUSE_CURVE_END     ((MOUSE_CURVE_POINTS-1)*MOUSE_CURVE_STEP)
+/**
+ * Maximum time (ms) a single report accounts for.
+ * This avoids jumps after the keyboard loop was blocked (eg. by a song).
+ */
+#define MOUSE_MAX_ELAPSED   16
+/** Wheel speed in notches per ms (8.8 fixed point): about 20 notches/s */
+#define MOUSE_WHEEL_SPEED   5
+
+/** Pointer speed (pixels/ms, 8.8 fixed point) by time the keys are held */
+static const uint16_t mouse_curves[MOUSE_CURVE_MAX][MOUSE_CURVE_POINTS] PROGMEM = {
+    /* 0.25 to 2 pixels/ms within 1s */
+    [MOUSE_CURVE_LINEAR] = {
+        64, 94, 124, 154, 183, 213, 243, 273, 303, 333, 363, 393, 422, 452, 482, 512
+    },
+    /* 0.1 to 3 pixels/ms within 1s */
+    [MOUSE_CURVE_QUADRATIC] = {
+        26, 29, 39, 55, 78, 108, 144, 187, 237, 293, 356, 425, 501, 583, 672, 768
+    },
+    /* 0.5 pixels/ms */
+    [MOUSE_CURVE_CONSTANT] = {
+        128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128, 128
+    }
+};
+
+static enum mouse_curve mouse_curve = MOUSE_CURVE_LINEAR;
+
+/** Number of held keys per direction (MOUSE_UP...MOUSE_RIGHT bit index) */
+static uint8_t mouse_move[4];
+/** Number of held wheel keys (up, down) */
+static uint8_t mouse_wheel[2];
+static uint8_t mouse_buttons = 0;
+/** Buttons changed since the last report */
+static bool mouse_dirty = false;
+
+/** Time the pointer started moving (ms) */
+static uint16_t mouse_start;
+/** Time of the last report (ms) */
+static uint16_t mouse_last;
+
+/** Accumulated movement not yet reported (8.8 fixed point) */
+static int16_t mouse_acc_x, mouse_acc_y, mouse_acc_v;
+
+/** Select the persisted acceleration curve */
+void mouse_init(void)
+{
+    uint8_t curve = settings_get(SETTING_MOUSE_CURVE);
+
+    mouse_curve = curve < MOUSE_CURVE_MAX ? curve : MOUSE_CURVE_LINEAR;
+}
+
+void mouse_select_curve(enum mouse_curve curve)
+{
+    mouse_curve = curve;
+    settings_set(SETTING_MOUSE_CURVE, curve);
+    LOG(COMMAND, INFO, "mouse acceleration curve: %u\n", curve);
+}
+
+enum mouse_curve mouse_get_curve(void)
+{
+    return mouse_curve;
+}
+
+static bool mouse_moving(void)
+{
+    return mouse_move[0] || mouse_move[1] || mouse_move[2] || mouse_move[3] ||
+           mouse_wheel[0] || mouse_wheel[1];
+}
+
+/**
+ * Look up the pointer speed on the acceleration curve.
+ *
+ * @param held Time the keys are held (ms).
+ * @return Speed in pixels/ms (8.8 fixed point).
+ */
+static uint16_t mouse_speed(uint16_t held)
+{
+    const uint16_t *curve = mouse_curves[mouse_curve];
+
+    /* also keeps the index below from wrapping */
+    if (held >= MOUSE_CURVE_END)
+        return pgm_read_word(&curve[MOUSE_CURVE_POINTS-1]);
+
+    uint8_t i = held / MOUSE_CURVE_STEP;
+
+    int16_t a = pgm_read_word(&curve[i]);
+    int16_t b = pgm_read_word(&curve[i+1]);
+
+    /* linear interpolation between the points */
+    return a + (int32_t)(b - a) * (held % MOUSE_CURVE_STEP) / MOUSE_CURVE_STEP;
+}
+
+/**
+ * Accumulate movement and take the whole units out of it.
+ *
+ * @param acc Accumulator (8.8 fixed point).
+ * @param delta Movement to add (8.8 fixed point).
+ * @return Units to report.
+ */
+static int8_t mouse_step(int16_t *acc, int16_t delta)
+{
+    *acc += delta;
+
+    int16_t units = *acc / 256;
+    if (units > 127)
+        units = 127;
+    else if (units < -127)
+        units = -127;
+
+    *acc -= units * 256;
+    return units;
+}
+
+/** Direction (-1, 0, 1) from two opposite counters */
+#define MOUSE_DIR(NEG, POS) ((int8_t)((POS) > 0) - (int8_t)((NEG) > 0))
+
+void mouse_task(void)
+{
+    report_mouse_t report = {.buttons = mouse_buttons};
+    uint16_t now = timer_read();
+
+    if (mouse_moving() && now != mouse_last) {
+        uint16_t elapsed = now - mouse_last;
+        if (elapsed > MOUSE_MAX_ELAPSED)
+            elapsed = MOUSE_MAX_ELAPSED;
+        mouse_last = now;
+        /* keep the held time from wrapping after 65s */
+        if ((uint16_t)(now - mouse_start) > MOUSE_CURVE_END)
+            mouse_start = now - MOUSE_CURVE_END;
+
+        int8_t dx = MOUSE_DIR(mouse_move[2], mouse_move[3]);
+        int8_t dy = MOUSE_DIR(mouse_move[0], mouse_move[1]);
+        int16_t dist = mouse_speed(now - mouse_start) * elapsed;
+
+        /* diagonal movement should not be faster: 181/256 ~= 1/sqrt(2) */
+        if (dx && dy)
+            dist = (int32_t)dist * 181 / 256;
+
+        report.x = mouse_step(&mouse_acc_x, dx*dist);
+        report.y = mouse_step(&mouse_acc_y, dy*dist);
+        report.v = mouse_step(&mouse_acc_v, MOUSE_DIR(mouse_wheel[1], mouse_wheel[0]) *
+                                            (int16_t)(MOUSE_WHEEL_SPEED*elapsed));
+    }
+
+    if (!mouse_dirty && !report.x && !report.y && !report.v)
+        return;
+    mouse_dirty = false;
+
+    host_mouse_send(&report);
+}
+
+/**
+ * Process mouse keys.
+ *
+ * @param id Mouse key (see mouse.h).
+ */
+void action_function(keyrecord_t *record, uint8_t id, uint8_t opt)
+{
+    bool pressed = record->event.pressed;
+
+    if (id & MOUSE_BUTTON) {
+        if (pressed)
+            mouse_buttons |= id & 0b111;
+        else
+            mouse_buttons &= ~(id & 0b111);
+        /* report it in this loop iteration */
+        mouse_dirty = true;
+        return;
+    }
+
+    if (pressed && !mouse_moving()) {
+        mouse_start = mouse_last = timer_read();
+        mouse_acc_x = mouse_acc_y = 0;
+        /* the first wheel notch is sent immediately */
+        mouse_acc_v = id & MOUSE_WHEEL ? (id & MOUSE_UP ? 255 : -255) : 0;
+    }
+
+    uint8_t *held = id & MOUSE_WHEEL ? mouse_wheel : mouse_move;
+    uint8_t count = id & MOUSE_WHEEL ? 2 : 4;
+
+    for (uint8_t i = 0; i < count; i++) {
+        if (!(id & (1 << i)))
+            continue;
+        if (pressed)
+            held[i]++;
+        else if (held[i])
+            held[i]--;
+    }
+}
+
+/**
+ * Release all mouse keys.
+ *
+ * When the layer changes while mouse keys are held, their releases
+ * are looked up on the new layer and never reach action_function(),
+ * so the pointer would keep moving.
+ */
+void mouse_clear(void)
+{
+    for (uint8_t i = 0; i < 4; i++)
+        mouse_move[i] = 0;
+    mouse_wheel[0] = mouse_wheel[1] = 0;
+
+    if (mouse_buttons) {
+        mouse_buttons = 0;
+        mouse_dirty = true;
+    }
+}
@@ -0,0 +1,80 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef MOUSE_H
+#define MOUSE_H
+
+#include <stdint.h>
+
+#include "action_code.h"
+
+/*
+ * Mouse keys.
+ *
+ * These are ACTION_FUNCTION() actions whose id encodes
+ * what the key does, see action_function() in mouse.c.
+ */
+#define MOUSE_UP        (1 << 0)
+#define MOUSE_DOWN      (1 << 1)
+#define MOUSE_LEFT      (1 << 2)
+#define MOUSE_RIGHT     (1 << 3)
+/** MOUSE_UP and MOUSE_DOWN refer to the wheel */
+#define MOUSE_WHEEL     (1 << 4)
+/** Bits 0-2 are a mask of buttons */
+#define MOUSE_BUTTON    (1 << 5)
+
+/** Move the pointer into the given directions */
+#define ACTION_MOUSE_MOVE(DIRS)     ACTION_FUNCTION(DIRS)
+/** Turn the wheel up or down */
+#define ACTION_MOUSE_WHEEL(DIR)     ACTION_FUNCTION(MOUSE_WHEEL | (DIR))
+/** Press buttons (MOUSE_BTN1...) */
+#define ACTION_MOUSE_BUTTON(BTNS)   ACTION_FUNCTION(MOUSE_BUTTON | (BTNS))
+
+/**
+ * Acceleration curves.
+ *
+ * @note New curves must be appended, so that the persisted
+ * selection stays valid.
+ */
+enum mouse_curve {
+    /** Speed increases linearly while a key is held */
+    MOUSE_CURVE_LINEAR = 0,
+    /** Slow start for precise positioning, but higher top speed */
+    MOUSE_CURVE_QUADRATIC,
+    /** Constant speed */
+    MOUSE_CURVE_CONSTANT,
+    /** not a real curve */
+    MOUSE_CURVE_MAX
+};
+
+#ifdef MOUSEKEY_ENABLE
+
+void mouse_init(void);
+void mouse_select_curve(enum mouse_curve curve);
+enum mouse_curve mouse_get_curve(void);
+void mouse_task(void);
+void mouse_clear(void);
+
+#else
+
+#define mouse_init()
+#define mouse_task()
+#define mouse_clear()
+
+#endif
+
+#endif
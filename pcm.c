@@ -0,0 +1,243 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+#include <avr/pgmspace.h>
+#include <util/atomic.h>
+
+#include "isrprof.h"
+#include "pwm.h"
+#include "pcm.h"
+
+/*
+ * PCM playback test on the buzzer (PD0).
+ *
+ * The buzzer can only be switched on and off, so 8-bit samples are
+ * converted into a 1-bit pulse density modulated (PDM) signal by a
+ * first-order sigma-delta modulator in the Timer 3 compare B interrupt.
+ * It outputs PCM_OVERSAMPLE bits per sample, ie. runs at 32 kHz.
+ * The buzzer and its resistor act as the low-pass filter.
+ *
+ * Samples are queued with pcm_write() into two buffers of PCM_BLOCK
+ * samples: while the interrupt plays back one of them, the other one is
+ * filled from the keyboard loop.
+ * Playback starts as soon as a buffer is full and stops (with the buzzer
+ * switched off) when the interrupt runs out of samples, so a stream
+ * may be interrupted at any time.
+ * Notes played with pwm_pd0_set_note() (songs, keyclicks and the Kana LED)
+ * take precedence: They take over Timer 3, which stops the stream and
+ * drops all queued samples.
+ * No stream is started while a note is playing.
+ *
+ * CPU budget: The interrupt fires every F_CPU/PCM_RATE/PCM_OVERSAMPLE
+ * = 500 cycles. It is estimated (from the C code, not measured) to take
+ * about 60 cycles, ie. roughly 12% of the CPU while playing.
+ * Measure it with ISRPROF_ENABLE (TIMER3_COMPB).
+ * It blocks other interrupts while it runs, so USB and the millisecond
+ * timer may be delayed by about 4us, and matrix scans take proportionally
+ * longer.
+ * Filling the buffers costs a few cycles per sample in the keyboard loop.
+ *
+ * This is only a local test of the playback path: pcm_test() plays a
+ * tone generated on the keyboard.
+ * Streaming from the host would require an USB Audio class interface
+ * (8 kHz mono, ie. 8 samples per isochronous frame passed to pcm_write()),
+ * but the USB descriptors and endpoints live in tmk_core.
+ */
+
+static int8_t pcm_buffers[2][PCM_BLOCK];
+/** Bit mask of buffers waiting for playback */
+static volatile uint8_t pcm_ready = 0;
+
+/** Buffer being filled by pcm_write() */
+static uint8_t pcm_fill_buffer = 0;
+static uint8_t pcm_fill_pos = 0;
+
+/*
+ * Playback state (interrupt only)
+ */
+static uint8_t pcm_play_buffer;
+static uint8_t pcm_play_pos;
+/** Interrupts until the next sample */
+static uint8_t pcm_repeat;
+/** Current sample (unsigned) */
+static uint8_t pcm_level;
+/** Sigma-delta accumulator */
+static uint8_t pcm_acc;
+
+/** Remaining amplitude of the test tone */
+static uint8_t pcm_test_amplitude = 0;
+static uint16_t pcm_test_phase;
+static uint8_t pcm_test_samples;
+
+/** One period of a sine wave */
+static const int8_t pcm_sine[32] PROGMEM = {
+    0, 25, 49, 71, 90, 106, 117, 125, 127, 125, 117, 106, 90, 71, 49, 25,
+    0, -25, -49, -71, -90, -106, -117, -125, -127, -125, -117, -106, -90, -71, -49, -25
+};
+
+static inline bool pcm_playing(void)
+{
+    return TIMSK3 & (1 << OCIE3B);
+}
+
+/** Whether a note (see pwm_pd0_set_note()) is using Timer 3 */
+static inline bool pcm_note_playing(void)
+{
+    return TIMSK3 & (1 << OCIE3A);
+}
+
+static void pcm_start(void)
+{
+    /* a note might currently be playing */
+    pwm_pd0_set_note(PWM_NOTE_OFF, 0);
+
+    /* the other buffer is older if both are waiting (see pcm_task()) */
+    pcm_play_buffer = pcm_ready & (1 << (pcm_fill_buffer ^ 1))
+                        ? pcm_fill_buffer ^ 1 : pcm_fill_buffer;
+    pcm_play_pos = 0;
+    pcm_repeat = 1;
+
+    /*
+     * CTC mode without prescaling: OCR3A is the PDM bit period.
+     * The compare B interrupt is used, so that the note interrupt
+     * (compare A) does not have to tell both apart.
+     */
+    TCCR3A = 0b00;
+    TCCR3B = 0b00001001;
+    OCR3A = F_CPU/PCM_RATE/PCM_OVERSAMPLE - 1;
+    OCR3B = 0;
+    TCNT3 = 0;
+    TIMSK3 = (1 << OCIE3B);
+}
+
+/**
+ * Queue samples for playback.
+ *
+ * This never blocks.
+ *
+ * @param samples Signed 8-bit samples at PCM_RATE.
+ * @param count Number of samples.
+ * @return Number of samples queued.
+ *     This is less than `count` if both buffers are full.
+ */
+uint8_t pcm_write(const int8_t *samples, uint8_t count)
+{
+    uint8_t written = 0;
+
+    while (written < count && !(pcm_ready & (1 << pcm_fill_buffer))) {
+        pcm_buffers[pcm_fill_buffer][pcm_fill_pos++] = samples[written++];
+        if (pcm_fill_pos < PCM_BLOCK)
+            continue;
+
+        ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+            pcm_ready |= (1 << pcm_fill_buffer);
+        }
+        if (!pcm_playing() && !pcm_note_playing())
+            pcm_start();
+        pcm_fill_buffer ^= 1;
+        pcm_fill_pos = 0;
+    }
+
+    return written;
+}
+
+/**
+ * Play a decaying 500 Hz test tone (about 1s).
+ */
+void pcm_test(void)
+{
+    pcm_test_amplitude = 0xFF;
+    pcm_test_phase = 0;
+    pcm_test_samples = 0;
+}
+
+/**
+ * Feed the playback buffers.
+ *
+ * This is called from the keyboard loop.
+ */
+void pcm_task(void)
+{
+    /*
+     * A note took over Timer 3 while buffers were waiting
+     * (or was playing when they were queued).
+     * Notes take precedence, so the stream is dropped.
+     * The interrupt is disabled, so pcm_ready can be reset safely.
+     */
+    if (pcm_ready && !pcm_playing()) {
+        pcm_ready = 0;
+        pcm_fill_pos = 0;
+        pcm_test_amplitude = 0;
+    }
+
+    while (pcm_test_amplitude) {
+        int8_t sample = (int8_t)pgm_read_byte(&pcm_sine[pcm_test_phase >> 11]) *
+                        pcm_test_amplitude >> 8;
+
+        if (!pcm_write(&sample, 1))
+            break;
+
+        pcm_test_phase += (uint32_t)500*0x10000/PCM_RATE;
+        /* decay by 1 every 32 samples, ie. 4ms */
+        if (!(++pcm_test_samples % 32))
+            pcm_test_amplitude--;
+    }
+}
+
+/*
+ * This must not be ISR_NOBLOCK: Under load, the next compare match could
+ * interrupt the previous one, which would corrupt the playback state.
+ */
+ISR(TIMER3_COMPB_vect)
+{
+    /* Timer 3 is not prescaled and restarts at the compare B match */
+    ISRPROF_ENTER(ISRPROF_TIMER3_COMPB, TCNT3);
+
+    if (!--pcm_repeat) {
+        pcm_repeat = PCM_OVERSAMPLE;
+
+        if (pcm_play_pos == PCM_BLOCK) {
+            pcm_ready &= ~(1 << pcm_play_buffer);
+            pcm_play_buffer ^= 1;
+            pcm_play_pos = 0;
+        }
+        if (!(pcm_ready & (1 << pcm_play_buffer))) {
+            /* out of samples */
+            TIMSK3 = 0;
+            PORTD &= ~(1 << PD0);
+            ISRPROF_EXIT(ISRPROF_TIMER3_COMPB, TCNT3);
+            return;
+        }
+
+        pcm_level = pcm_buffers[pcm_play_buffer][pcm_play_pos++] + 128;
+    }
+
+    /* output the carry of the accumulator */
+    uint8_t acc = pcm_acc;
+    pcm_acc += pcm_level;
+    if (pcm_acc < acc)
+        PORTD |= (1 << PD0);
+    else
+        PORTD &= ~(1 << PD0);
+
+    ISRPROF_EXIT(ISRPROF_TIMER3_COMPB, TCNT3);
+}
@@ -0,0 +1,42 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PCM_H
+#define PCM_H
+
+#include <stdint.h>
+
+/** Sample rate (Hz) */
+#define PCM_RATE 8000
+/** PDM bits per sample, ie. Timer 3 interrupts per sample */
+#define PCM_OVERSAMPLE 4
+/** Samples per buffer (4ms) */
+#define PCM_BLOCK 32
+
+#ifdef PCM_ENABLE
+
+uint8_t pcm_write(const int8_t *samples, uint8_t count);
+void pcm_test(void);
+void pcm_task(void);
+
+#else
+
+#define pcm_task()
+
+#endif
+
+#endif
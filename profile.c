@@ -0,0 +1,92 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <string.h>
+
+#include <avr/pgmspace.h>
+
+#include "log.h"
+#include "debounce.h"
+#include "settings.h"
+#include "profile.h"
+
+static const struct profile profile_table[PROFILE_MAX] PROGMEM = {
+    [PROFILE_STANDARD] = {
+        .name = "standard",
+        .debounce = 0,
+        .settle = 30,
+        .scan_interval = 0,
+        .flags = PROFILE_KEYCLICK | PROFILE_ANIMATION
+    },
+    [PROFILE_FAST] = {
+        .name = "fast",
+        .debounce = 2,
+        /* may have to be raised on keyboards with long column lines */
+        .settle = 20,
+        .scan_interval = 0,
+        .flags = PROFILE_KEYCLICK | PROFILE_EARLY_COMMIT
+    },
+    [PROFILE_QUIET] = {
+        .name = "quiet",
+        .debounce = 10,
+        .settle = 30,
+        .scan_interval = 8,
+        .flags = PROFILE_IDLE_SLEEP
+    }
+};
+
+struct profile profile;
+
+static enum profile_id profile_id;
+
+/** Select the persisted profile */
+void profile_init(void)
+{
+    uint8_t id = settings_get(SETTING_SCAN_PROFILE);
+
+    profile_select(id < PROFILE_MAX ? id : PROFILE_STANDARD);
+}
+
+/**
+ * Select and persist a scan profile.
+ *
+ * The profile is copied into RAM, so that the matrix scan can access
+ * it cheaply.
+ */
+void profile_select(enum profile_id id)
+{
+    memcpy_P(&profile, &profile_table[id], sizeof(profile));
+    profile_id = id;
+
+    /* the settle time is turned into an 8-bit delay loop count by matrix_scan() */
+    if (!profile.settle)
+        profile.settle = 1;
+    else if (profile.settle > PROFILE_SETTLE_MAX)
+        profile.settle = PROFILE_SETTLE_MAX;
+
+    debounce_set_fixed(profile.debounce);
+    settings_set(SETTING_SCAN_PROFILE, id);
+
+    /* log arguments are formatted later, so pass no pointers into `profile` */
+    LOG(COMMAND, INFO, "scan profile: %u\n", (uint16_t)id);
+}
+
+enum profile_id profile_get(void)
+{
+    return profile_id;
+}
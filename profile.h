@@ -0,0 +1,73 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <stdint.h>
+
+/**
+ * Scan profiles.
+ *
+ * @note New profiles must be appended, so that the persisted
+ * selection stays valid.
+ */
+enum profile_id {
+    /** Adaptive debouncing, continuous scanning, all features */
+    PROFILE_STANDARD = 0,
+    /**
+     * Lowest latency: fixed 2ms debounce window, short settle time,
+     * early commits and no (blocking) animations
+     */
+    PROFILE_FAST,
+    /** Long fixed debounce window, slow scanning, no noise, CPU sleeps */
+    PROFILE_QUIET,
+    /** not a real profile */
+    PROFILE_MAX
+};
+
+/** Keyclicks (solenoid and buzzer) are allowed */
+#define PROFILE_KEYCLICK    (1 << 0)
+/** Songs and LED animations are allowed */
+#define PROFILE_ANIMATION   (1 << 1)
+/** Sleep (idle mode) between scans */
+#define PROFILE_IDLE_SLEEP  (1 << 2)
+/** Return committed changes without finishing the scan (like LOWLATENCY_ENABLE) */
+#define PROFILE_EARLY_COMMIT (1 << 3)
+
+/** Longest column settle time (us) that fits into _delay_loop_1() */
+#define PROFILE_SETTLE_MAX (255*3 / (F_CPU/1000000UL))
+
+struct profile {
+    char name[9];
+    /** Fixed debounce window for all keys (ms) or 0 for adaptive debouncing */
+    uint8_t debounce;
+    /** Column settle time (us), 1-PROFILE_SETTLE_MAX (47 at 16MHz) */
+    uint8_t settle;
+    /** Minimum time between matrix scans (ms) */
+    uint8_t scan_interval;
+    uint8_t flags;
+};
+
+/** Currently selected profile */
+extern struct profile profile;
+
+void profile_init(void);
+void profile_select(enum profile_id id);
+enum profile_id profile_get(void);
+
+#endif
@@ -21,8 +21,11 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <avr/io.h>
 #include <avr/interrupt.h>
 #include <avr/pgmspace.h>
+#include <util/atomic.h>
 
 #include "debug.h"
+#include "timer.h"
+#include "isrprof.h"
 #include "pwm.h"
 
 /**
@@ -96,6 +99,15 @@ static const uint16_t pwm_table16[256] PROGMEM = {
     0xF888, 0xFB02, 0xFD7E, 0xFFFF
 };
 
+/**
+ * Brightness last set per LED (see pwm_set_led()).
+ * This allows us to touch only the LEDs that actually changed.
+ * -1 means unknown.
+ */
+static int16_t pwm_led_brightness[5] = {-1, -1, -1, -1, -1};
+/** Note and fine-tuning last set by pwm_pd0_set_note() */
+static uint16_t pwm_tone_key = PWM_NOTE_OFF << 8;
+
 /**
  * Configure a PWM pin of Timer 1 (16-bit resolution).
  *
@@ -106,8 +118,13 @@ static void pwm_timer1_init(uint8_t channel)
 {
     /* Fast PWM on OC1x, inverted duty cycle, TOP = ICR1 */
     TCCR1A |= (0b11 << (3-channel)*2) | 0b10;
-    /* stop timer */
-    TCCR1B = 0;
+
+    /*
+     * The timer is shared with the other channels, so
+     * restarting it would make them flicker.
+     */
+    if (TCCR1B & 0b111)
+        return;
     /* TOP for PWM - full 16 Bit */
     ICR1 = 0xFFFF;
     /* no prescaling */
@@ -116,6 +133,10 @@ static void pwm_timer1_init(uint8_t channel)
 
 void pwm_pb5_set_led(uint8_t brightness)
 {
+    if (pwm_led_brightness[0] == brightness)
+        return;
+    pwm_led_brightness[0] = brightness;
+
     switch (brightness) {
         case 0:
             TCCR1A &= ~0b11000000;
@@ -134,6 +155,10 @@ void pwm_pb5_set_led(uint8_t brightness)
 
 void pwm_pb6_set_led(uint8_t brightness)
 {
+    if (pwm_led_brightness[4] == brightness)
+        return;
+    pwm_led_brightness[4] = brightness;
+
     switch (brightness) {
         case 0:
             TCCR1A &= ~0b00110000;
@@ -152,6 +177,10 @@ void pwm_pb6_set_led(uint8_t brightness)
 
 void pwm_pb7_set_led(uint8_t brightness)
 {
+    if (pwm_led_brightness[2] == brightness)
+        return;
+    pwm_led_brightness[2] = brightness;
+
     switch (brightness) {
         case 0:
             TCCR1A &= ~0b00001100;
@@ -184,6 +213,10 @@ static void pwm_timer2_init(uint8_t channel)
 
 void pwm_pb4_set_led(uint8_t brightness)
 {
+    if (pwm_led_brightness[3] == brightness)
+        return;
+    pwm_led_brightness[3] = brightness;
+
     switch (brightness) {
         case 0:
             TCCR2A &= ~0b11000000;
@@ -202,6 +235,10 @@ void pwm_pb4_set_led(uint8_t brightness)
 
 void pwm_pd1_set_led(uint8_t brightness)
 {
+    if (pwm_led_brightness[1] == brightness)
+        return;
+    pwm_led_brightness[1] = brightness;
+
     switch (brightness) {
         case 0:
             TCCR2A &= ~0b00110000;
@@ -235,8 +272,51 @@ void pwm_set_led(uint8_t led, uint8_t brightness)
      }
 }
 
+#if F_CPU != 16000000UL
+#error "pwm_notes must be regenerated for this F_CPU"
+#endif
+
+/**
+ * Timer 3 settings per MIDI note (PWM_NOTE_MIN to 127, 16 Hz to 12.5 kHz).
+ *
+ * The prescaler is chosen as small as possible for the best resolution.
+ * Prescaler 1 works down to 122 Hz, lower notes require prescaler 8.
+ * This is calculated by the formula:
+ * ```
+ * freq = 440 * pow(2, (note - 69) / 12.0);
+ * prescaler = F_CPU/2/freq - 1 <= 0xFFFF ? 1 : 8;
+ * ocr = round(F_CPU/2/prescaler/freq) - 1;
+ * ```
+ */
+static const struct pwm_note {
+    uint16_t ocr;
+    /** Clock select bits (1: no prescaling, 2: prescaler 8) */
+    uint8_t cs;
+} pwm_notes[128-PWM_NOTE_MIN] PROGMEM = {
+    {0xEEE3, 2}, {0xE17B, 2}, {0xD4D3, 2}, {0xC8E1, 2}, {0xBD9B, 2}, {0xB2F6, 2},
+    {0xA8EB, 2}, {0x9F70, 2}, {0x967D, 2}, {0x8E0B, 2}, {0x8612, 2}, {0x7E8B, 2},
+    {0x7771, 2}, {0x70BD, 2}, {0x6A69, 2}, {0x6470, 2}, {0x5ECD, 2}, {0x597B, 2},
+    {0x5475, 2}, {0x4FB7, 2}, {0x4B3E, 2}, {0x4705, 2}, {0x4308, 2}, {0x3F45, 2},
+    {0x3BB8, 2}, {0x385E, 2}, {0x3534, 2}, {0x3237, 2}, {0x2F66, 2}, {0x2CBD, 2},
+    {0x2A3A, 2}, {0x27DB, 2}, {0x259E, 2}, {0x2382, 2}, {0x2184, 2}, {0xFD18, 1},
+    {0xEEE3, 1}, {0xE17B, 1}, {0xD4D3, 1}, {0xC8E1, 1}, {0xBD9B, 1}, {0xB2F6, 1},
+    {0xA8EB, 1}, {0x9F70, 1}, {0x967D, 1}, {0x8E0B, 1}, {0x8612, 1}, {0x7E8B, 1},
+    {0x7771, 1}, {0x70BD, 1}, {0x6A69, 1}, {0x6470, 1}, {0x5ECD, 1}, {0x597B, 1},
+    {0x5475, 1}, {0x4FB7, 1}, {0x4B3E, 1}, {0x4705, 1}, {0x4308, 1}, {0x3F45, 1},
+    {0x3BB8, 1}, {0x385E, 1}, {0x3534, 1}, {0x3237, 1}, {0x2F66, 1}, {0x2CBD, 1},
+    {0x2A3A, 1}, {0x27DB, 1}, {0x259E, 1}, {0x2382, 1}, {0x2184, 1}, {0x1FA2, 1},
+    {0x1DDC, 1}, {0x1C2E, 1}, {0x1A99, 1}, {0x191B, 1}, {0x17B2, 1}, {0x165E, 1},
+    {0x151C, 1}, {0x13ED, 1}, {0x12CF, 1}, {0x11C0, 1}, {0x10C1, 1}, {0x0FD1, 1},
+    {0x0EED, 1}, {0x0E17, 1}, {0x0D4C, 1}, {0x0C8D, 1}, {0x0BD9, 1}, {0x0B2E, 1},
+    {0x0A8E, 1}, {0x09F6, 1}, {0x0967, 1}, {0x08E0, 1}, {0x0860, 1}, {0x07E8, 1},
+    {0x0776, 1}, {0x070B, 1}, {0x06A6, 1}, {0x0646, 1}, {0x05EC, 1}, {0x0597, 1},
+    {0x0546, 1}, {0x04FB, 1}, {0x04B3, 1}, {0x046F, 1}, {0x0430, 1}, {0x03F3, 1},
+    {0x03BB, 1}, {0x0385, 1}, {0x0352, 1}, {0x0323, 1}, {0x02F5, 1}, {0x02CB, 1},
+    {0x02A3, 1}, {0x027D, 1}
+};
+
 /**
- * Play a tone on PD0 (the buzzer).
+ * Play a note on PD0 (the buzzer).
  *
  * @note This uses timer 3 with an IRQ, even though we cannot
  * use one of the Timer 3 PWM pins -- they are required for matrix
@@ -256,15 +336,27 @@ void pwm_set_led(uint8_t led, uint8_t brightness)
  * some day use an IRQ for playing back (bit banging) audio samples eg.
  * for a keyclick sounds.
  *
+ * The timer settings of every note are looked up from pwm_notes,
+ * so no division is necessary and changing the pitch is cheap.
+ *
  * @todo It would be nice, if we could specify the tone's volume.
  * This will reduce the effective resolution to 15 bit, but that should be
  * sufficient anyway.
  *
- * @param freq Frequency to play. If 0, disables the buzzer.
+ * @param note MIDI note number to play (A4 == 69).
+ *     PWM_NOTE_OFF (or any note below PWM_NOTE_MIN) disables the buzzer.
+ * @param fine Fine-tuning in 1/256 semitones upwards.
+ *     This is interpolated linearly between the neighbouring notes.
  */
-void pwm_pd0_set_tone(uint16_t freq)
+void pwm_pd0_set_note(uint8_t note, uint8_t fine)
 {
-    if (!freq) {
+    uint16_t key = (uint16_t)note << 8 | fine;
+
+    if (key == pwm_tone_key)
+        return;
+    pwm_tone_key = key;
+
+    if (note < PWM_NOTE_MIN || note > 127) {
         /*
          * There should be a way to turn off the buzzer as we would otherwise
          * always have some kind of tone.
@@ -273,6 +365,19 @@ void pwm_pd0_set_tone(uint16_t freq)
         return;
     }
 
+    const struct pwm_note *entry = &pwm_notes[note-PWM_NOTE_MIN];
+    uint16_t ocr = pgm_read_word(&entry->ocr);
+    uint8_t cs = pgm_read_byte(&entry->cs);
+
+    if (fine && note < 127) {
+        uint16_t next = pgm_read_word(&entry[1].ocr);
+
+        /* the next note may use a smaller prescaler (8 vs. 1) */
+        if (pgm_read_byte(&entry[1].cs) != cs)
+            next = ((next+1) >> 3) - 1;
+        ocr -= (uint32_t)(ocr - next) * fine >> 8;
+    }
+
     /*
      * CTC mode: Effectively allows us to toggle the pin after OCR3A counts.
      * This allows us to use the full 16-bit resolution.
@@ -280,25 +385,198 @@ void pwm_pd0_set_tone(uint16_t freq)
      * control the cycle length independently, reducing resolution to 15 bit.
      */
     TCCR3A = 0b00;
-    /*
-     * Prescaling: 8 (0b010).
-     * This allows for frequencies between 15 Hz and 1 MHz.
-     *
-     * FIXME: It may be even better to use 1 if we have frequencies below 122 Hz.
-     */
-    TCCR3B = 0b00001010;
+    TCCR3B = 0b00001000 | cs;
 
     /*
      * The frequency of the resulting signal is calculated as follows:
      * F_CPU / PRESCALER / (CYCLE_LENGTH+1) / 2
      */
-    OCR3A = (F_CPU/2/8) / freq - 1;
+    OCR3A = ocr;
 
     /* enable TIMER3_COMPA_vect() interrupt */
     TIMSK3 = (1 << OCIE3A);
 }
 
+/** CPU cycles since the last Timer 3 compare match (for ISRPROF_ENTER()) */
+static inline uint16_t pwm_timer3_cycles(void)
+{
+    return (TCCR3B & 0b111) == 2 ? TCNT3 << 3 : TCNT3;
+}
+
 ISR(TIMER3_COMPA_vect, ISR_NOBLOCK)
 {
+    ISRPROF_ENTER(ISRPROF_TIMER3_COMPA, pwm_timer3_cycles());
     PORTD ^= (1 << PD0);
+    ISRPROF_EXIT(ISRPROF_TIMER3_COMPA, pwm_timer3_cycles());
+}
+
+/** Remaining full-power pull-in time of the solenoid (ms) */
+static volatile uint8_t pwm_solenoid_pulse;
+/** Remaining hold time of the solenoid (ms) */
+static volatile uint8_t pwm_solenoid_hold;
+/** Hold duty cycle of the solenoid in Timer 0 ticks */
+static uint8_t pwm_solenoid_duty;
+
+/**
+ * Drive the solenoid (PB3) with peak-and-hold.
+ *
+ * The solenoid needs the full current only to pull in.
+ * Afterwards, it is held with a low duty cycle, which reduces the
+ * average current and therefore the load on the USB bus.
+ *
+ * PB3 is not a PWM pin, so it is switched by the Timer 0 compare B
+ * interrupt. Timer 0 is TMK's millisecond timer, which runs in CTC mode
+ * with TOP = OCR0A, so this results in a 1kHz PWM.
+ * The solenoid is switched off automatically after the hold time
+ * without any polling.
+ *
+ * @param pulse Pull-in time (ms).
+ * @param hold Hold time following the pull-in (ms).
+ * @param duty Hold duty cycle (percent).
+ */
+void pwm_pb3_solenoid_pulse(uint8_t pulse, uint8_t hold, uint8_t duty)
+{
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+        pwm_solenoid_pulse = pulse;
+        pwm_solenoid_hold = hold;
+        pwm_solenoid_duty = duty >= 100 ? OCR0A+1 : (uint16_t)duty*(OCR0A+1)/100;
+
+        PORTB |= (1 << PB3);
+        OCR0B = 0;
+        TIFR0 = (1 << OCF0B);
+        TIMSK0 |= (1 << OCIE0B);
+    }
+}
+
+void pwm_pb3_solenoid_off(void)
+{
+    TIMSK0 &= ~(1 << OCIE0B);
+    PORTB &= ~(1 << PB3);
+}
+
+/**
+ * Step the solenoid's peak-and-hold state machine.
+ *
+ * @param ocr Value of OCR0B that caused the compare match.
+ */
+static inline void pwm_solenoid_step(uint8_t ocr)
+{
+    if (ocr) {
+        /* end of the hold duty cycle */
+        PORTB &= ~(1 << PB3);
+        OCR0B = 0;
+        return;
+    }
+
+    /* start of a Timer 0 cycle */
+    if (pwm_solenoid_pulse) {
+        pwm_solenoid_pulse--;
+        return;
+    }
+    if (!pwm_solenoid_hold || !pwm_solenoid_duty) {
+        pwm_pb3_solenoid_off();
+        return;
+    }
+    pwm_solenoid_hold--;
+
+    PORTB |= (1 << PB3);
+    /* at 100%, OCR0B stays 0 and the pin is never turned off */
+    if (pwm_solenoid_duty <= OCR0A)
+        OCR0B = pwm_solenoid_duty;
+}
+
+/**
+ * CPU cycles since Timer 0 matched `ocr` (for ISRPROF_ENTER()).
+ * Timer 0 counts up to OCR0A in 64 cycle steps.
+ */
+static inline uint16_t pwm_timer0_cycles(uint8_t ocr)
+{
+    uint8_t count = TCNT0;
+
+    return (count >= ocr ? count - ocr : count + OCR0A+1 - ocr) * 64;
+}
+
+ISR(TIMER0_COMPB_vect)
+{
+    uint8_t ocr = OCR0B;
+
+    ISRPROF_ENTER(ISRPROF_TIMER0_COMPB, pwm_timer0_cycles(ocr));
+    pwm_solenoid_step(ocr);
+    ISRPROF_EXIT(ISRPROF_TIMER0_COMPB, pwm_timer0_cycles(ocr));
+}
+
+#ifdef BREATHING_LED_ENABLE
+
+/** Duration of one Timer 1 cycle (us) */
+#define PWM_TIMER1_PERIOD_US (0x10000UL*1000000UL/F_CPU)
+
+volatile bool pwm_breathing = false;
+
+static uint8_t pwm_breathing_brightness;
+static uint16_t pwm_breathing_phase;
+static uint16_t pwm_breathing_us;
+
+/**
+ * Start a "breathing" animation on G00 (PB5/OC1A).
+ *
+ * This is meant for USB suspend, when the CPU is sleeping most of the time.
+ * The LED is driven by the hardware PWM and the duty cycle is stepped
+ * only on every Timer 1 overflow (244 Hz), which is the only
+ * regular wakeup while breathing.
+ * Timer 0 (TMK's millisecond timer) is stopped, so we have to
+ * keep it going (see below).
+ *
+ * @param brightness Maximum brightness level.
+ */
+void pwm_breathing_start(uint8_t brightness)
+{
+    pwm_breathing_brightness = brightness;
+    pwm_breathing_phase = 0;
+    pwm_breathing = true;
+
+    /* G00 is restored by the next led_set() */
+    pwm_led_brightness[0] = -1;
+    pwm_timer1_init(0);
+    OCR1A = 0;
+    TIFR1 = (1 << TOV1);
+    TIMSK1 |= (1 << TOIE1);
+
+    TIMSK0 &= ~(1 << OCIE0A);
+    PRR0 |= (1 << PRTIM0);
+}
+
+void pwm_breathing_stop(void)
+{
+    PRR0 &= ~(1 << PRTIM0);
+    TCNT0 = 0;
+    TIMSK0 |= (1 << OCIE0A);
+
+    TIMSK1 &= ~(1 << TOIE1);
+    pwm_breathing = false;
 }
+
+ISR(TIMER1_OVF_vect)
+{
+    /* Timer 1 runs without prescaler and overflows to 0 */
+    ISRPROF_ENTER(ISRPROF_TIMER1_OVF, TCNT1);
+
+    /*
+     * Advance the millisecond timer in place of the Timer 0 interrupt.
+     * This is precise enough for debouncing the remote wakeup scans.
+     */
+    timer_count += PWM_TIMER1_PERIOD_US / 1000;
+    pwm_breathing_us += PWM_TIMER1_PERIOD_US % 1000;
+    if (pwm_breathing_us >= 1000) {
+        pwm_breathing_us -= 1000;
+        timer_count++;
+    }
+
+    /* one breath takes 1024 overflows (about 4.2s) */
+    uint16_t phase = pwm_breathing_phase++ / 2 % 512;
+    uint8_t level = phase < 256 ? phase : 511 - phase;
+    OCR1A = pgm_read_word(&pwm_table16[(uint16_t)level*pwm_breathing_brightness/255]);
+
+    ISRPROF_EXIT(ISRPROF_TIMER1_OVF, TCNT1);
+}
+
+#endif
@@ -19,6 +19,7 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #define PWM_H
 
 #include <stdint.h>
+#include <stdbool.h>
 
 void pwm_pd1_set_led(uint8_t brightness);
 void pwm_pb4_set_led(uint8_t brightness);
@@ -28,6 +29,21 @@ void pwm_pb7_set_led(uint8_t brightness);
 
 void pwm_set_led(uint8_t led, uint8_t brightness);
 
-void pwm_pd0_set_tone(uint16_t freq);
+/** Lowest note supported by pwm_pd0_set_note() (C0) */
+#define PWM_NOTE_MIN 12
+/** Note for turning off the buzzer */
+#define PWM_NOTE_OFF 0
+
+void pwm_pd0_set_note(uint8_t note, uint8_t fine);
+
+void pwm_pb3_solenoid_pulse(uint8_t pulse, uint8_t hold, uint8_t duty);
+void pwm_pb3_solenoid_off(void);
+
+#ifdef BREATHING_LED_ENABLE
+extern volatile bool pwm_breathing;
+
+void pwm_breathing_start(uint8_t brightness);
+void pwm_breathing_stop(void);
+#endif
 
 #endif
@@ -0,0 +1,9 @@
+/* Host replacement for <avr/pgmspace.h> used by k7637-render.c */
+#ifndef RENDER_PGMSPACE_H
+#define RENDER_PGMSPACE_H
+
+#define PROGMEM
+#define pgm_read_byte(ADDR) (*(const uint8_t *)(ADDR))
+#define pgm_read_word(ADDR) (*(const uint16_t *)(ADDR))
+
+#endif
@@ -0,0 +1,4 @@
+/* Host replacement for TMK's debug.h used by k7637-render.c */
+#ifndef RENDER_DEBUG_H
+#define RENDER_DEBUG_H
+#endif
@@ -0,0 +1,9 @@
+/* Host replacement for TMK's host.h used by k7637-render.c */
+#ifndef RENDER_HOST_H
+#define RENDER_HOST_H
+
+#include <stdint.h>
+
+uint8_t host_keyboard_leds(void);
+
+#endif
@@ -0,0 +1,325 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Offline renderer for the songs and animations of song.c.
+ *
+ * song.c is compiled for the host against a virtual clock:
+ * _delay_ms() advances the clock and timer_read() reads it,
+ * so the real playback code runs unmodified but instantly.
+ * The buzzer output is written as a WAV file, the five LED brightness tracks
+ * as CSV and the cumulative timing error of every note (compared to the
+ * song's note table) is printed to stdout.
+ *
+ * The virtual clock does not account for the time spent executing the
+ * playback code itself, so the reported errors are caused by the
+ * playback algorithm (rounding, polling granularity) only.
+ *
+ * Build and run from the repository root:
+ *
+ *     cc -O2 -Irender -o k7637-render render/k7637-render.c -lm
+ *     ./k7637-render -o kitt kitt
+ */
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <unistd.h>
+
+#include "../song.c"
+
+#define F_CPU 16000000UL
+/** Sample rate of the WAV output (Hz) */
+#define RENDER_RATE 44100
+/** Amplitude of the buzzer's square wave */
+#define RENDER_AMPLITUDE 8000
+/** Maximum number of recorded note changes */
+#define RENDER_EVENTS 1024
+
+enum keyclick_mode keyclick_mode = KEYCLICK_OFF;
+
+/** Virtual time (us) */
+static uint64_t render_time = 0;
+/** Number of WAV samples written */
+static uint64_t render_samples = 0;
+
+static FILE *render_wav, *render_csv;
+
+/** Current buzzer frequency (Hz) or 0 */
+static double render_freq = 0;
+static double render_phase = 0;
+
+static uint8_t render_leds[5];
+static int render_leds_dirty = 0;
+
+/** Note changes requested by the song */
+static struct {
+    uint64_t time;
+    uint8_t note;
+} render_events[RENDER_EVENTS];
+static unsigned int render_events_count = 0;
+static unsigned int render_note_calls = 0;
+
+static void render_flush_leds(void)
+{
+    if (!render_leds_dirty)
+        return;
+    render_leds_dirty = 0;
+
+    fprintf(render_csv, "%.3f", render_time/1000.);
+    for (int i = 0; i < 5; i++)
+        fprintf(render_csv, ",%u", render_leds[i]);
+    fputc('\n', render_csv);
+}
+
+void _delay_ms(double ms)
+{
+    render_flush_leds();
+
+    render_time += (uint64_t)(ms*1000);
+
+    /* write all samples up to the new virtual time */
+    while (render_samples*1000000/RENDER_RATE < render_time) {
+        int16_t sample = 0;
+
+        if (render_freq > 0) {
+            sample = render_phase < 0.5 ? RENDER_AMPLITUDE : -RENDER_AMPLITUDE;
+            render_phase = fmod(render_phase + render_freq/RENDER_RATE, 1);
+        }
+
+        fputc(sample & 0xFF, render_wav);
+        fputc(sample >> 8 & 0xFF, render_wav);
+        render_samples++;
+    }
+}
+
+uint16_t timer_read(void)
+{
+    return render_time/1000;
+}
+
+uint16_t timer_elapsed(uint16_t last)
+{
+    return timer_read() - last;
+}
+
+void led_set(uint8_t usb_led)
+{
+    (void)usb_led;
+}
+
+uint8_t host_keyboard_leds(void)
+{
+    return 0;
+}
+
+void pwm_set_led(uint8_t led, uint8_t brightness)
+{
+    if (render_leds[led] == brightness)
+        return;
+    render_leds[led] = brightness;
+    render_leds_dirty = 1;
+}
+
+void pwm_pb3_solenoid_off(void) {}
+
+/**
+ * Calculate the frequency Timer 3 would generate for a note.
+ *
+ * This mirrors pwm_notes and pwm_pd0_set_note() including
+ * the rounding of the OCR3A values, so the rendered pitch is the real one.
+ */
+static double render_note_freq(uint8_t note, uint8_t fine)
+{
+    uint32_t prescaler[2];
+    uint32_t ocr[2];
+
+    for (int i = 0; i < 2; i++) {
+        double freq = 440*pow(2, (note+i-69)/12.);
+
+        prescaler[i] = F_CPU/2/freq - 1 > 0xFFFF ? 8 : 1;
+        ocr[i] = lround((double)F_CPU/prescaler[i]/2/freq) - 1;
+    }
+
+    if (fine && note < 127) {
+        uint32_t next = ocr[1];
+
+        if (prescaler[1] != prescaler[0])
+            next = ((next+1) >> 3) - 1;
+        ocr[0] -= (ocr[0] - next) * fine >> 8;
+    }
+
+    return (double)F_CPU/prescaler[0]/(ocr[0]+1)/2;
+}
+
+void pwm_pd0_set_note(uint8_t note, uint8_t fine)
+{
+    render_freq = note < PWM_NOTE_MIN || note > 127 ? 0 : render_note_freq(note, fine);
+
+    /*
+     * The first call only silences the buzzer before the song starts.
+     * Repeated calls for the same note do not start a new note.
+     */
+    if (render_note_calls++ == 0 ||
+        (render_events_count && render_events[render_events_count-1].note == note))
+        return;
+    if (render_events_count < RENDER_EVENTS) {
+        render_events[render_events_count].time = render_time;
+        render_events[render_events_count].note = note;
+        render_events_count++;
+    }
+}
+
+/**
+ * Compare the recorded note changes with the note table.
+ *
+ * Consecutive table entries with the same note cannot be told apart
+ * in the output, so they are merged.
+ */
+static int render_report(const struct song_note *table, size_t len)
+{
+    uint64_t expected = 0;
+    int64_t max_error = 0;
+    unsigned int event = 0;
+
+    printf("note   expected(ms)   actual(ms)   error(ms)\n");
+
+    for (size_t i = 0; i <= len; i++) {
+        if (i < len && i > 0 && table[i].note == table[i-1].note) {
+            expected += table[i].dur;
+            continue;
+        }
+
+        if (event >= render_events_count) {
+            fprintf(stderr, "Song ended prematurely\n");
+            return 1;
+        }
+
+        int64_t actual = (render_events[event].time - render_events[0].time)/1000;
+        int64_t error = actual - (int64_t)expected;
+
+        printf("%4u %14llu %12lld %+11lld\n", render_events[event].note,
+               (unsigned long long)expected, (long long)actual, (long long)error);
+        if (llabs(error) > llabs(max_error))
+            max_error = error;
+
+        if (i < len)
+            expected += table[i].dur;
+        event++;
+    }
+
+    printf("Cumulative error: %+lld ms, maximum: %+lld ms\n",
+           (long long)(render_events[event-1].time - render_events[0].time)/1000 -
+               (long long)expected,
+           (long long)max_error);
+    return 0;
+}
+
+static void render_wav_header(uint32_t samples)
+{
+    uint32_t data_size = samples*2;
+    uint8_t header[44] = "RIFF____WAVEfmt ";
+
+    #define PUT16(OFF, V) (header[OFF] = (V) & 0xFF, header[(OFF)+1] = (V) >> 8 & 0xFF)
+    #define PUT32(OFF, V) (PUT16(OFF, V), PUT16((OFF)+2, (V) >> 16))
+    PUT32(4, 36 + data_size);
+    PUT32(16, 16);              /* fmt chunk size */
+    PUT16(20, 1);               /* PCM */
+    PUT16(22, 1);               /* mono */
+    PUT32(24, RENDER_RATE);
+    PUT32(28, RENDER_RATE*2);   /* byte rate */
+    PUT16(32, 2);               /* block align */
+    PUT16(34, 16);              /* bits per sample */
+    memcpy(header+36, "data", 4);
+    PUT32(40, data_size);
+    #undef PUT32
+    #undef PUT16
+
+    fwrite(header, sizeof(header), 1, render_wav);
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "Usage: %s [-o prefix] ruinen|kitt\n", argv0);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    const char *prefix = NULL;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "o:")) != -1) {
+        switch (opt) {
+        case 'o':
+            prefix = optarg;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    if (optind+1 != argc)
+        usage(argv[0]);
+
+    const char *song = argv[optind];
+    void (*play)(void);
+    const struct song_note *table;
+    size_t len;
+
+    if (!strcmp(song, "ruinen")) {
+        play = song_play_ruinen;
+        table = song_ruinen;
+        len = sizeof(song_ruinen)/sizeof(song_ruinen[0]);
+    } else if (!strcmp(song, "kitt")) {
+        play = song_play_kitt;
+        table = song_knight_rider;
+        len = sizeof(song_knight_rider)/sizeof(song_knight_rider[0]);
+    } else {
+        usage(argv[0]);
+    }
+    if (!prefix)
+        prefix = song;
+
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s.wav", prefix);
+    render_wav = fopen(path, "wb");
+    snprintf(path, sizeof(path), "%s.csv", prefix);
+    render_csv = fopen(path, "w");
+    if (!render_wav || !render_csv) {
+        perror("fopen");
+        return EXIT_FAILURE;
+    }
+
+    /* the header is rewritten once the length is known */
+    render_wav_header(0);
+    fprintf(render_csv, "time_ms,led0,led1,led2,led3,led4\n");
+    render_leds_dirty = 1;
+
+    play();
+    render_flush_leds();
+
+    rewind(render_wav);
+    render_wav_header(render_samples);
+    fclose(render_wav);
+    fclose(render_csv);
+
+    printf("Rendered %.3f s of %s\n", render_time/1e6, song);
+    return render_report(table, len) ? EXIT_FAILURE : EXIT_SUCCESS;
+}
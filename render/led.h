@@ -0,0 +1,9 @@
+/* Host replacement for TMK's led.h used by k7637-render.c */
+#ifndef RENDER_LED_H
+#define RENDER_LED_H
+
+#include <stdint.h>
+
+void led_set(uint8_t usb_led);
+
+#endif
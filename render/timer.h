@@ -0,0 +1,10 @@
+/* Host replacement for TMK's timer.h used by k7637-render.c */
+#ifndef RENDER_TIMER_H
+#define RENDER_TIMER_H
+
+#include <stdint.h>
+
+uint16_t timer_read(void);
+uint16_t timer_elapsed(uint16_t last);
+
+#endif
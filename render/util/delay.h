@@ -0,0 +1,8 @@
+/* Host replacement for <util/delay.h> used by k7637-render.c */
+#ifndef RENDER_DELAY_H
+#define RENDER_DELAY_H
+
+/** Advances the virtual clock */
+void _delay_ms(double ms);
+
+#endif
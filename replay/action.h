@@ -0,0 +1,25 @@
+/* Host replacement for TMK's action.h used by the host harnesses */
+#ifndef REPLAY_ACTION_H
+#define REPLAY_ACTION_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "action_code.h"
+#include "keyboard.h"
+
+typedef struct {
+    bool interrupted:1;
+    uint8_t count:4;
+} tap_t;
+
+typedef struct {
+    keyevent_t event;
+    tap_t tap;
+} keyrecord_t;
+
+action_t layer_switch_get_action(keypos_t key);
+void register_code(uint8_t code);
+void unregister_code(uint8_t code);
+
+#endif
@@ -0,0 +1,46 @@
+/* Host replacement for TMK's action_code.h used by the host harnesses */
+#ifndef REPLAY_ACTION_CODE_H
+#define REPLAY_ACTION_CODE_H
+
+#include <stdint.h>
+
+typedef union {
+    uint16_t code;
+    struct {
+        uint8_t code;
+        uint8_t mods:4;
+        uint8_t kind:4;
+    } key;
+    struct {
+        uint16_t param:12;
+        uint8_t id:4;
+    } kind;
+} action_t;
+
+enum action_kind_id {
+    ACT_MODS        = 0b0000,
+    ACT_LMODS       = 0b0000,
+    ACT_RMODS       = 0b0001,
+    ACT_MODS_TAP    = 0b0010,
+    ACT_LMODS_TAP   = 0b0010,
+    ACT_RMODS_TAP   = 0b0011
+};
+
+enum mods_bit {
+    MOD_LCTL = 0x01,
+    MOD_LSFT = 0x02,
+    MOD_LALT = 0x04,
+    MOD_LGUI = 0x08,
+    MOD_RCTL = 0x11,
+    MOD_RSFT = 0x12,
+    MOD_RALT = 0x14,
+    MOD_RGUI = 0x18
+};
+
+#define ACTION(KIND, PARAM) ((KIND) << 12 | (PARAM))
+#define ACTION_NO           0
+#define ACTION_TRANSPARENT  1
+#define ACTION_KEY(KEY)     ACTION(ACT_MODS, (KEY))
+#define ACTION_MODS_TAP_KEY(MODS, KEY) ACTION(ACT_MODS_TAP, ((MODS)&0x1f) << 8 | (KEY))
+
+#endif
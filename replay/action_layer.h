@@ -0,0 +1,9 @@
+/* Host replacement for TMK's action_layer.h used by the host harnesses */
+#ifndef REPLAY_ACTION_LAYER_H
+#define REPLAY_ACTION_LAYER_H
+
+#include <stdint.h>
+
+extern uint32_t layer_state, default_layer_state;
+
+#endif
@@ -0,0 +1,11 @@
+/* Host replacement for TMK's action_util.h used by the host harnesses */
+#ifndef REPLAY_ACTION_UTIL_H
+#define REPLAY_ACTION_UTIL_H
+
+#include <stdint.h>
+
+void send_keyboard_report(void);
+void add_mods(uint8_t mods);
+void del_mods(uint8_t mods);
+
+#endif
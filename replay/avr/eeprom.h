@@ -0,0 +1,14 @@
+/* Host replacement for <avr/eeprom.h> used by the host harnesses (always erased) */
+#ifndef REPLAY_EEPROM_H
+#define REPLAY_EEPROM_H
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#define eeprom_is_ready() true
+#define eeprom_read_block(DST, SRC, SIZE) memset((DST), 0xFF, (SIZE))
+#define eeprom_read_byte(ADDR) ((void)(ADDR), (uint8_t)0xFF)
+#define eeprom_write_byte(ADDR, VALUE) ((void)(ADDR), (void)(VALUE))
+
+#endif
@@ -0,0 +1,11 @@
+/* Host replacement for <avr/pgmspace.h> used by the host harnesses */
+#ifndef REPLAY_PGMSPACE_H
+#define REPLAY_PGMSPACE_H
+
+#include <stdint.h>
+
+#define PROGMEM
+#define pgm_read_byte(ADDR) (*(const uint8_t *)(ADDR))
+#define pgm_read_word(ADDR) (*(const uint16_t *)(ADDR))
+
+#endif
@@ -0,0 +1,9 @@
+/* Host replacement for TMK's debug.h used by the host harnesses */
+#ifndef REPLAY_DEBUG_H
+#define REPLAY_DEBUG_H
+
+#include <stdbool.h>
+
+extern bool debug_enable;
+
+#endif
@@ -0,0 +1,14 @@
+/* Host replacement for TMK's hook.h used by the host harnesses */
+#ifndef REPLAY_HOOK_H
+#define REPLAY_HOOK_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "action.h"
+
+void hook_layer_change(uint32_t layer_state);
+void hook_default_layer_change(uint32_t default_layer_state);
+bool hook_process_action(keyrecord_t *record);
+
+#endif
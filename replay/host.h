@@ -0,0 +1,9 @@
+/* Host replacement for TMK's host.h used by the host harnesses */
+#ifndef REPLAY_HOST_H
+#define REPLAY_HOST_H
+
+#include <stdint.h>
+
+uint8_t host_keyboard_leds(void);
+
+#endif
@@ -0,0 +1,512 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Host simulator for the dual-role keys (dualrole.c).
+ *
+ * dualrole.c is compiled for the host and key event traces are fed
+ * through hook_process_action() like TMK's action processing would.
+ * Keys that are not handled by the hook are registered like TMK does
+ * (one report per key event).
+ * The keymap is the matrix layout of unimap_trans.h with ET1 and ET2
+ * as dual-role keys (see unimap_00.c) and all other keys sending their
+ * Unimap codes.
+ *
+ * Every report is sent to the host in its own USB frame, so a key
+ * whose report is preceded by additional reports is delayed by up to
+ * one frame (1ms) per additional report.
+ * For every press of a key that is not a dual-role key, the number of
+ * additional reports sent before its own report is counted, separately
+ * for presses with no dual-role key down, with a pending dual-role key
+ * (which is decided as held by this press) and with a dual-role key
+ * already held (by an earlier press or after TAPPING_TERM).
+ * The simulator also checks that held dual-role keys have registered
+ * their modifiers before the key's report and that taps send their key.
+ * dualrole_task() is run before every event, like the keyboard loop would.
+ *
+ * Without arguments, synthetic typing with rollover, dual-role taps and
+ * dual-role chords is simulated.
+ * Otherwise, the commits of the given trace CSVs (see k7637-trace.py)
+ * are replayed.
+ *
+ * Build and run from the repository root:
+ *
+ *     cc -O2 -Ireplay -include config.h -o k7637-dualrole replay/k7637-dualrole.c
+ *     ./k7637-dualrole [-n keystrokes] [-s seed] [trace.csv...]
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+/* tick.h reads the AVR timer */
+#define TICK_H
+#define TICK_US 4
+static uint32_t tick_read(void);
+
+#include "../dualrole.c"
+#include "../unimap_trans.h"
+
+#define AC_ET1 ACTION_MODS_TAP_KEY(MOD_LCTL, KC_ESC)
+#define AC_ET2 ACTION_MODS_TAP_KEY(MOD_RALT, KC_APP)
+
+/** Unimap codes of ET1 and ET2 (see unimap_00.c) */
+#define SIM_UNIMAP_ET1 0x7A
+#define SIM_UNIMAP_ET2 0x7E
+
+bool debug_enable = false;
+matrix_row_t keymap_overlay_map[MATRIX_ROWS];
+
+struct sim_event {
+    uint32_t time;
+    keypos_t key;
+    bool pressed;
+    /** Sequence number, keeps the order of simultaneous events */
+    uint32_t seq;
+};
+
+static struct sim_event *sim_events = NULL;
+static size_t sim_event_count = 0, sim_event_size = 0;
+
+/** Virtual time (ms) */
+static uint32_t sim_time = 0;
+
+/** Keyboard report state */
+static uint8_t sim_mods = 0;
+static uint8_t sim_keys[32];
+/** Number of reports sent */
+static unsigned long sim_reports = 0;
+/** Report number of the last register_code() */
+static unsigned long sim_registered = 0;
+/** Mods of the last register_code() report */
+static uint8_t sim_registered_mods = 0;
+
+enum sim_category {
+    /** No dual-role key down */
+    SIM_NONE = 0,
+    /** Pending dual-role key, decided as held by this press */
+    SIM_PENDING,
+    /** Dual-role key already held */
+    SIM_HELD,
+    SIM_MAX
+};
+
+static const char *const sim_category_names[SIM_MAX] = {
+    "no dual-role down", "dual-role pending", "dual-role held"
+};
+
+static struct {
+    unsigned long presses;
+    unsigned long extra_sum, extra_max;
+} sim_stats[SIM_MAX];
+
+static unsigned long sim_taps, sim_holds;
+static uint32_t sim_seed = 1;
+
+uint16_t timer_read(void)
+{
+    return sim_time;
+}
+
+uint32_t timer_read32(void)
+{
+    return sim_time;
+}
+
+static uint32_t tick_read(void)
+{
+    return sim_time*1000/TICK_US;
+}
+
+void log_push(const char *fmt, uint16_t a, uint16_t b, uint16_t c, uint16_t d)
+{
+    printf(fmt, a, b, c, d);
+}
+
+bool keymap_overlay_process(keyrecord_t *record)
+{
+    (void)record;
+    return false;
+}
+
+action_t layer_switch_get_action(keypos_t key)
+{
+    uint8_t code = pgm_read_byte(&unimap_trans[key.row][key.col]);
+
+    switch (code) {
+        /* K78 and K7C are NO in unimap_00.c */
+        case 0x78:
+        case 0x7C:
+        case UNIMAP_NO:      return (action_t){.code = ACTION_NO};
+        case SIM_UNIMAP_ET1: return (action_t){.code = AC_ET1};
+        case SIM_UNIMAP_ET2: return (action_t){.code = AC_ET2};
+    }
+
+    /* 0x78-0x7F are the modifiers */
+    return (action_t){.code = ACTION_KEY(code >= 0x78 ? KC_LCTRL + code-0x78 : code)};
+}
+
+void send_keyboard_report(void)
+{
+    sim_reports++;
+}
+
+void add_mods(uint8_t mods)
+{
+    sim_mods |= mods;
+}
+
+void del_mods(uint8_t mods)
+{
+    sim_mods &= ~mods;
+}
+
+void register_code(uint8_t code)
+{
+    if (IS_MOD(code))
+        sim_mods |= MOD_BIT(code);
+    else
+        sim_keys[code/8] |= 1 << (code%8);
+    send_keyboard_report();
+
+    sim_registered = sim_reports;
+    sim_registered_mods = sim_mods;
+}
+
+void unregister_code(uint8_t code)
+{
+    if (IS_MOD(code))
+        sim_mods &= ~MOD_BIT(code);
+    else
+        sim_keys[code/8] &= ~(1 << (code%8));
+    send_keyboard_report();
+}
+
+static void sim_fail(const struct sim_event *event, const char *what)
+{
+    fprintf(stderr, "%ums, key %u/%u %s: %s\n", event->time,
+            event->key.row, event->key.col,
+            event->pressed ? "pressed" : "released", what);
+    exit(EXIT_FAILURE);
+}
+
+static void sim_push(uint32_t time, uint8_t row, uint8_t col, bool pressed)
+{
+    if (sim_event_count == sim_event_size) {
+        sim_event_size = sim_event_size ? sim_event_size*2 : 1024;
+        sim_events = realloc(sim_events, sim_event_size*sizeof(*sim_events));
+        if (!sim_events) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    sim_events[sim_event_count] = (struct sim_event){
+        time, {.col = col, .row = row}, pressed, sim_event_count
+    };
+    sim_event_count++;
+}
+
+static int sim_compare(const void *a, const void *b)
+{
+    const struct sim_event *x = a, *y = b;
+
+    if (x->time != y->time)
+        return x->time < y->time ? -1 : 1;
+    return x->seq < y->seq ? -1 : x->seq > y->seq;
+}
+
+static bool sim_is_dualrole(keypos_t key)
+{
+    action_t action = layer_switch_get_action(key);
+
+    return action.kind.id == ACT_LMODS_TAP || action.kind.id == ACT_RMODS_TAP;
+}
+
+/** 8-bit modifier mask of a dual-role key */
+static uint8_t sim_dualrole_mods(keypos_t key)
+{
+    action_t action = layer_switch_get_action(key);
+
+    return action.kind.id == ACT_LMODS_TAP ? action.key.mods : action.key.mods << 4;
+}
+
+/** xorshift32 */
+static uint32_t sim_random(void)
+{
+    static uint32_t state = 0;
+
+    if (!state)
+        state = sim_seed ? : 1;
+
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static uint32_t sim_range(uint32_t min, uint32_t max)
+{
+    return min + sim_random() % (max-min+1);
+}
+
+/**
+ * Generate synthetic typing.
+ *
+ * Keystrokes start every 30-200ms and last 40-150ms, so fast typing
+ * rolls over.
+ * 15% are dual-role keys pressed alone for 40-300ms, ie. some of them
+ * exceed TAPPING_TERM, and another 15% dual-role chords with 1-3 keys,
+ * which are released after the dual-role key in one third of the chords.
+ */
+static void sim_generate(unsigned long keystrokes)
+{
+    keypos_t keys[MATRIX_ROWS*MATRIX_COLS], duals[2];
+    uint32_t busy[MATRIX_ROWS][MATRIX_COLS] = {{0}};
+    size_t key_count = 0, dual_count = 0;
+    uint32_t time = 0;
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            keypos_t key = {.col = col, .row = row};
+
+            /* "security key" pseudo-keys */
+            if ((row == 0 && col == 13) || (row < 6 && col == MATRIX_COLS-1) ||
+                layer_switch_get_action(key).code == ACTION_NO)
+                continue;
+            if (sim_is_dualrole(key))
+                duals[dual_count++] = key;
+            else
+                keys[key_count++] = key;
+        }
+    }
+
+    for (unsigned long i = 0; i < keystrokes; i++) {
+        uint32_t type = sim_random() % 100;
+        keypos_t key = keys[sim_random() % key_count];
+        keypos_t dual = duals[sim_random() % dual_count];
+
+        time += sim_range(30, 200);
+
+        if (type < 70) {
+            if (busy[key.row][key.col] >= time)
+                continue;
+            busy[key.row][key.col] = time + sim_range(40, 150);
+            sim_push(time, key.row, key.col, true);
+            sim_push(busy[key.row][key.col], key.row, key.col, false);
+        } else if (type < 85) {
+            if (busy[dual.row][dual.col] >= time)
+                continue;
+            busy[dual.row][dual.col] = time + sim_range(40, 300);
+            sim_push(time, dual.row, dual.col, true);
+            sim_push(busy[dual.row][dual.col], dual.row, dual.col, false);
+        } else {
+            uint32_t t = time + sim_range(20, 100), end = t;
+            uint8_t n = sim_range(1, 3);
+
+            if (busy[dual.row][dual.col] >= time)
+                continue;
+            sim_push(time, dual.row, dual.col, true);
+            for (uint8_t j = 0; j < n; j++, t += sim_range(40, 120)) {
+                key = keys[sim_random() % key_count];
+                if (busy[key.row][key.col] >= t)
+                    continue;
+                busy[key.row][key.col] = t + sim_range(40, 100);
+                sim_push(t, key.row, key.col, true);
+                sim_push(busy[key.row][key.col], key.row, key.col, false);
+                if (busy[key.row][key.col] > end)
+                    end = busy[key.row][key.col];
+            }
+            /* release the dual-role key before the last key sometimes */
+            busy[dual.row][dual.col] = sim_random() % 3 ? end + sim_range(10, 80) : t;
+            sim_push(busy[dual.row][dual.col], dual.row, dual.col, false);
+            time = busy[dual.row][dual.col] > end ? busy[dual.row][dual.col] : end;
+        }
+    }
+}
+
+/** Load the commits of a trace CSV written by k7637-trace.py */
+static bool sim_load(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    char line[256];
+
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+
+    while (fgets(line, sizeof(line), file)) {
+        unsigned long time;
+        unsigned row, col;
+        char edge[16], outcome[16];
+
+        if (sscanf(line, "%lu,%u,%u,%15[a-z],%15[a-z]", &time, &row, &col, edge, outcome) != 5 ||
+            strcmp(outcome, "commit") || row >= MATRIX_ROWS || col >= MATRIX_COLS)
+            continue;
+        sim_push(time/1000, row, col, !strcmp(edge, "press"));
+    }
+
+    fclose(file);
+    return true;
+}
+
+/** Feed all events through hook_process_action() like TMK's process_record() */
+static void sim_run(void)
+{
+    /* dual-role keys down and whether they have been decided */
+    bool down[MATRIX_ROWS][MATRIX_COLS] = {{false}};
+    bool decided[MATRIX_ROWS][MATRIX_COLS] = {{false}};
+    uint32_t down_time[MATRIX_ROWS][MATRIX_COLS];
+
+    qsort(sim_events, sim_event_count, sizeof(*sim_events), sim_compare);
+
+    for (size_t i = 0; i < sim_event_count; i++) {
+        const struct sim_event *event = sim_events+i;
+        keyrecord_t record = {.event = {event->key, event->pressed, event->time}};
+        bool dualrole = sim_is_dualrole(event->key);
+        enum sim_category category = SIM_NONE;
+        uint8_t held_mods = 0;
+
+        /* the keyboard loop runs between any two events */
+        sim_time = event->time;
+        dualrole_task();
+
+        unsigned long reports = sim_reports;
+
+        for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+            for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+                if (down[row][col] && sim_time - down_time[row][col] >= TAPPING_TERM)
+                    decided[row][col] = true;
+            }
+        }
+
+        if (event->pressed) {
+            for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+                for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+                    if (!down[row][col])
+                        continue;
+                    if (!decided[row][col])
+                        category = SIM_PENDING;
+                    else if (category == SIM_NONE)
+                        category = SIM_HELD;
+                    decided[row][col] = true;
+                    held_mods |= sim_dualrole_mods((keypos_t){.col = col, .row = row});
+                }
+            }
+        }
+
+        if (!hook_process_action(&record)) {
+            action_t action = layer_switch_get_action(event->key);
+
+            if (action.code != ACTION_NO) {
+                if (event->pressed)
+                    register_code(action.key.code);
+                else
+                    unregister_code(action.key.code);
+            }
+        }
+
+        if (dualrole) {
+            bool tap = !decided[event->key.row][event->key.col];
+
+            if (event->pressed) {
+                down[event->key.row][event->key.col] = true;
+                decided[event->key.row][event->key.col] = false;
+                down_time[event->key.row][event->key.col] = event->time;
+            } else if (down[event->key.row][event->key.col]) {
+                down[event->key.row][event->key.col] = false;
+                if (tap) {
+                    sim_taps++;
+                    if (sim_reports-reports != 2)
+                        sim_fail(event, "tap did not send its key");
+                } else {
+                    sim_holds++;
+                    if (sim_mods & sim_dualrole_mods(event->key))
+                        sim_fail(event, "modifiers not released");
+                }
+            }
+            continue;
+        }
+        if (!event->pressed || layer_switch_get_action(event->key).code == ACTION_NO)
+            continue;
+
+        if (sim_registered <= reports)
+            sim_fail(event, "key was not reported");
+        if ((sim_registered_mods & held_mods) != held_mods)
+            sim_fail(event, "dual-role modifiers missing from the key's report");
+
+        unsigned long extra = sim_registered - reports - 1;
+        sim_stats[category].presses++;
+        sim_stats[category].extra_sum += extra;
+        if (extra > sim_stats[category].extra_max)
+            sim_stats[category].extra_max = extra;
+    }
+}
+
+static void sim_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n keystrokes] [-s seed] [trace.csv...]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    unsigned long keystrokes = 100000;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            keystrokes = strtoul(optarg, NULL, 10);
+            break;
+        case 's':
+            sim_seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            sim_usage(argv[0]);
+        }
+    }
+
+    if (optind < argc) {
+        for (int i = optind; i < argc; i++) {
+            if (!sim_load(argv[i]))
+                return EXIT_FAILURE;
+        }
+    } else {
+        sim_generate(keystrokes);
+    }
+
+    sim_run();
+
+    printf("%zu events, %lu dual-role taps, %lu dual-role holds\n\n",
+           sim_event_count, sim_taps, sim_holds);
+    printf("%-20s %8s %12s %12s\n", "other key pressed", "presses",
+           "extra avg", "extra max");
+    for (uint8_t i = 0; i < SIM_MAX; i++) {
+        printf("%-20s %8lu %12.3f %12lu\n", sim_category_names[i],
+               sim_stats[i].presses,
+               sim_stats[i].presses ? (double)sim_stats[i].extra_sum/sim_stats[i].presses : 0,
+               sim_stats[i].extra_max);
+    }
+    printf("\nExtra reports delay the key by up to one USB frame (1ms) each.\n");
+
+    return EXIT_SUCCESS;
+}
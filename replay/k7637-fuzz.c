@@ -0,0 +1,442 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Randomized property test for the matrix state machines.
+ *
+ * debounce.c, security_key.c and keyclick.c are compiled for the host
+ * and driven by random raw matrices, "security key" codes, keyclick
+ * settings and scan intervals (including 16-bit timer wraparounds)
+ * instead of the real matrix.
+ * The scan of matrix.c is mirrored like in k7637-replay.c and every scan
+ * is checked for the following:
+ *
+ *  - Every commit sets the key to its raw state and happens only
+ *    after the key's raw state was stable for at least DEBOUNCE_MIN ms
+ *    (or the fixed debounce window).
+ *  - No key is stuck, ie. a key whose raw state was stable for
+ *    DEBOUNCE_MAX ms (or the fixed window) is committed.
+ *  - Pseudo-keys (F18-F24) are only pressed on scans that decoded a
+ *    change of the "security key", are pressed for exactly one scan
+ *    and form a valid insertion (one of F19-F24) or removal
+ *    (F18 and one of F19-F24).
+ *  - The solenoid is released by the first scan at or after
+ *    KEYCLICK_SOLENOID_EXTENDTIME after it was last fired.
+ *  - The keyclick beep is stopped by the first scan at or after
+ *    KEYCLICK_BUZZER_TIME and the Kana LED's tone is restored.
+ *
+ * The first violation is printed together with the seed and the
+ * program fails, so a failing run can be repeated exactly.
+ *
+ * Build and run from the repository root:
+ *
+ *     cc -O2 -Ireplay -include config.h -o k7637-fuzz replay/k7637-fuzz.c
+ *     ./k7637-fuzz [-n scans] [-s seed]
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../debounce.c"
+#include "../security_key.c"
+#include "../keyclick.c"
+
+/** Pseudo-keys in row 0 (F18 and F19) */
+#define FUZZ_PSEUDO_ROW0 ((1 << 13) | (1 << (MATRIX_COLS-1)))
+/** Keys that are flipped most of the time, so that they bounce */
+#define FUZZ_HOT_KEYS 8
+
+bool debug_enable = false;
+
+struct profile profile = {"fuzz", 0, 30, 0, PROFILE_KEYCLICK};
+enum keyclick_mode keyclick_mode = KEYCLICK_SOLENOID;
+
+static uint32_t fuzz_seed;
+static uint64_t fuzz_scan;
+
+/** Virtual time (ms) */
+static uint32_t fuzz_time = 0;
+
+static uint8_t fuzz_settings[SETTING_MAX];
+static uint8_t fuzz_leds = 0;
+
+/** Whether the solenoid is energized and when it was last fired */
+static bool fuzz_solenoid = false;
+static uint32_t fuzz_solenoid_time;
+/** Current buzzer note and when it was set */
+static uint8_t fuzz_note = PWM_NOTE_OFF;
+static uint32_t fuzz_note_time;
+
+static struct {
+    uint64_t commits, pseudo_keys, solenoid, beeps;
+} fuzz_stats;
+
+uint16_t timer_read(void)
+{
+    return fuzz_time;
+}
+
+uint32_t timer_read32(void)
+{
+    return fuzz_time;
+}
+
+void log_push(const char *fmt, uint16_t a, uint16_t b, uint16_t c, uint16_t d)
+{
+    printf(fmt, a, b, c, d);
+}
+
+uint8_t settings_get(enum setting key)
+{
+    return fuzz_settings[key];
+}
+
+uint8_t host_keyboard_leds(void)
+{
+    return fuzz_leds;
+}
+
+void pwm_pd0_set_note(uint8_t note, uint8_t fine)
+{
+    (void)fine;
+    if (note != PWM_NOTE_OFF && note != KEYCLICK_KANA_NOTE)
+        fuzz_stats.beeps++;
+    fuzz_note = note;
+    fuzz_note_time = fuzz_time;
+}
+
+void pwm_pb3_solenoid_pulse(uint8_t pulse, uint8_t hold, uint8_t duty)
+{
+    (void)duty;
+    if (pulse + hold > KEYCLICK_SOLENOID_EXTENDTIME) {
+        printf("seed %u, scan %llu: solenoid pulse %u+%ums is too long\n",
+               fuzz_seed, (unsigned long long)fuzz_scan, pulse, hold);
+        exit(EXIT_FAILURE);
+    }
+    fuzz_solenoid = true;
+    fuzz_solenoid_time = fuzz_time;
+    fuzz_stats.solenoid++;
+}
+
+void pwm_pb3_solenoid_off(void)
+{
+    fuzz_solenoid = false;
+}
+
+/** xorshift32 */
+static uint32_t fuzz_random(void)
+{
+    static uint32_t state = 0;
+
+    if (!state)
+        state = fuzz_seed ? : 1;
+    state ^= state << 13;
+    state ^= state >> 17;
+    state ^= state << 5;
+    return state;
+}
+
+static void fuzz_fail(const char *what, uint8_t row, uint8_t col)
+{
+    printf("seed %u, scan %llu, %ums: %s (row %u, col %u)\n",
+           fuzz_seed, (unsigned long long)fuzz_scan, fuzz_time, what, row, col);
+    exit(EXIT_FAILURE);
+}
+
+static matrix_row_t fuzz_pseudo_keys(uint8_t row)
+{
+    if (row == 0)
+        return FUZZ_PSEUDO_ROW0;
+    return row < SECURITY_KEY_ROWS ? 1 << (MATRIX_COLS-1) : 0;
+}
+
+/**
+ * Reference model of the "security key" sampling.
+ *
+ * A code is accepted after SECURITY_KEY_SAMPLES identical samples
+ * (the first code counts as accepted).
+ *
+ * @param code The sampled "security key" bits.
+ * @param expected Filled with the pseudo-keys expected for this sample.
+ */
+static void fuzz_security_sample(uint8_t code, matrix_row_t expected[])
+{
+    static uint8_t raw = 0, count = SECURITY_KEY_SAMPLES, key = 0;
+
+    if (code != raw) {
+        raw = code;
+        count = 1;
+        return;
+    }
+    if (count >= SECURITY_KEY_SAMPLES || ++count < SECURITY_KEY_SAMPLES || code == key)
+        return;
+
+    if (key == 0 && 1 <= code && code <= 6) {
+        expected[code-1] |= 1 << (MATRIX_COLS-1);
+    } else if (1 <= key && key <= 6 && code == 0) {
+        expected[0] |= 1 << 13;
+        expected[key-1] |= 1 << (MATRIX_COLS-1);
+    }
+    key = code;
+}
+
+/** Time between two scans (ms) */
+static uint32_t fuzz_interval(void)
+{
+    uint32_t r = fuzz_random();
+
+    switch (r % 64) {
+        case 0:  return (r >> 8) % 1000; /* stalled, eg. by a blocking song */
+        case 1:  return (r >> 8) % 100;
+        default: return (r >> 8) % 3;
+    }
+}
+
+/**
+ * Change the raw matrix, "security key", keyclick mode, settings
+ * and LEDs at random.
+ */
+static void fuzz_mutate(matrix_row_t raw[], uint8_t *security_code,
+                        const uint8_t hot[][2])
+{
+    uint32_t r = fuzz_random();
+
+    if (r % 4 == 0) {
+        const uint8_t *key = hot[(r >> 8) % FUZZ_HOT_KEYS];
+        raw[key[0]] ^= 1 << key[1];
+    }
+    if (r % 64 == 1) {
+        uint8_t row = (r >> 8) % MATRIX_ROWS;
+        raw[row] ^= (matrix_row_t)(r >> 16);
+    }
+    if (r % 512 == 2)
+        *security_code = (r >> 8) % 8;
+
+    switch ((r >> 16) % 8192) {
+        case 0:
+            /* like command_extra() */
+            keyclick_mode = (r >> 4) % KEYCLICK_MAX;
+            keyclick_stop();
+            break;
+        case 1:
+            fuzz_settings[SETTING_SOLENOID_PULSE] = r >> 24;
+            fuzz_settings[SETTING_SOLENOID_HOLD] = r >> 4;
+            break;
+        case 2:
+            /* like led_set() */
+            fuzz_leds ^= 1 << USB_LED_KANA;
+            if (fuzz_leds & (1 << USB_LED_KANA))
+                pwm_pd0_set_note(KEYCLICK_KANA_NOTE, KEYCLICK_KANA_FINE);
+            else
+                pwm_pd0_set_note(PWM_NOTE_OFF, 0);
+            break;
+        case 3:
+            profile.flags ^= PROFILE_KEYCLICK;
+            break;
+        case 4: {
+            /* like profile_select() */
+            static const uint8_t windows[] = {0, 2, 5, 10};
+            profile.debounce = windows[(r >> 4) % sizeof(windows)];
+            debounce_set_fixed(profile.debounce);
+            break;
+        }
+    }
+
+    /* pseudo-key positions are not wired */
+    raw[0] &= ~(1 << 13);
+}
+
+/**
+ * Mirror of matrix_scan() with checks.
+ *
+ * @param matrix Matrix state as reported to TMK.
+ * @param last_edge Time of the last raw edge of every key (ms).
+ */
+static void fuzz_scan_matrix(matrix_row_t matrix[], matrix_row_t debounced[],
+                             matrix_row_t debouncing[], const matrix_row_t raw[],
+                             uint8_t security_code, uint32_t last_edge[][MATRIX_COLS])
+{
+    static uint16_t security_key_time = 0;
+    uint16_t now = timer_read();
+    bool changed = false, pressed = false, security_changed = false;
+    matrix_row_t before[MATRIX_ROWS], committed[MATRIX_ROWS] = {0};
+    matrix_row_t expected[SECURITY_KEY_ROWS] = {0};
+    matrix_row_t pseudo_prev = 0;
+
+    memcpy(before, debounced, sizeof(before));
+
+    for (uint8_t row = 0; row < SECURITY_KEY_ROWS; row++)
+        pseudo_prev |= matrix[row] & fuzz_pseudo_keys(row);
+
+    for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+        uint8_t row = 0;
+
+        if (col == MATRIX_COLS-1) {
+            if ((uint16_t)(now - security_key_time) >= SECURITY_KEY_INTERVAL) {
+                security_key_time = now;
+                security_changed = security_key_update(security_code);
+                fuzz_security_sample(security_code, expected);
+            }
+            row = SECURITY_KEY_ROWS;
+        }
+
+        for (; row < MATRIX_ROWS; row++) {
+            if (!((debouncing[row] ^ raw[row]) & (1 << col)))
+                continue;
+            debouncing[row] ^= 1 << col;
+            debounce_edge(row, col, now);
+            last_edge[row][col] = fuzz_time;
+        }
+
+        uint8_t changed_rows = debounce_col(debounced, debouncing, col, now);
+
+        for (row = 0; changed_rows >> row; row++) {
+            matrix_row_t mask = 1 << col;
+            uint8_t window = profile.debounce ? : DEBOUNCE_MIN;
+
+            if (!(changed_rows & (1 << row)))
+                continue;
+            if ((debounced[row] ^ debouncing[row]) & mask)
+                fuzz_fail("committed state differs from the raw state", row, col);
+            if (fuzz_time - last_edge[row][col] < window)
+                fuzz_fail("committed before the debounce window elapsed", row, col);
+            if (fuzz_pseudo_keys(row) & mask)
+                fuzz_fail("pseudo-key position committed", row, col);
+
+            committed[row] |= mask;
+            fuzz_stats.commits++;
+            if (debounced[row] & mask)
+                pressed = true;
+        }
+        changed |= changed_rows != 0;
+    }
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        matrix_row_t uncommitted = debounced[row] ^ debouncing[row];
+        uint8_t window = profile.debounce ? : DEBOUNCE_MAX;
+
+        if ((before[row] ^ debounced[row]) != committed[row])
+            fuzz_fail("debounce_col() reported the wrong rows", row, 0);
+
+        for (uint8_t col = 0; uncommitted; col++, uncommitted >>= 1) {
+            if ((uncommitted & 1) && fuzz_time - last_edge[row][col] >= window)
+                fuzz_fail("key is stuck", row, col);
+        }
+    }
+
+    if (pressed)
+        keyclick_start(now);
+
+    if (changed || security_changed) {
+        memcpy(matrix, debounced, sizeof(*matrix)*MATRIX_ROWS);
+        if (security_changed)
+            security_key_decode(matrix);
+    } else {
+        security_key_release(matrix);
+    }
+
+    keyclick_poll(now);
+
+    matrix_row_t pseudo = 0;
+    for (uint8_t row = 0; row < SECURITY_KEY_ROWS; row++)
+        pseudo |= matrix[row] & fuzz_pseudo_keys(row);
+    if (pseudo && pseudo_prev)
+        fuzz_fail("pseudo-key pressed for more than one scan", 0, MATRIX_COLS-1);
+    for (uint8_t row = 0; row < SECURITY_KEY_ROWS; row++) {
+        if ((matrix[row] & fuzz_pseudo_keys(row)) != expected[row])
+            fuzz_fail("pseudo-keys differ from the expected insertion or removal",
+                      row, MATRIX_COLS-1);
+    }
+    fuzz_stats.pseudo_keys += !!pseudo;
+
+    if (fuzz_solenoid && fuzz_time - fuzz_solenoid_time >= KEYCLICK_SOLENOID_EXTENDTIME)
+        fuzz_fail("solenoid still energized", 0, 0);
+    uint8_t idle_note = fuzz_leds & (1 << USB_LED_KANA) ? KEYCLICK_KANA_NOTE : PWM_NOTE_OFF;
+    if (fuzz_note != idle_note && fuzz_time - fuzz_note_time >= KEYCLICK_BUZZER_TIME)
+        fuzz_fail("keyclick beep not stopped or Kana tone not restored", 0, 0);
+}
+
+static void fuzz_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-n scans] [-s seed]\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    uint64_t scans = 10000000;
+    matrix_row_t matrix[MATRIX_ROWS] = {0};
+    matrix_row_t debounced[MATRIX_ROWS] = {0}, debouncing[MATRIX_ROWS] = {0};
+    matrix_row_t raw[MATRIX_ROWS] = {0};
+    uint32_t last_edge[MATRIX_ROWS][MATRIX_COLS] = {{0}};
+    uint8_t hot[FUZZ_HOT_KEYS][2];
+    uint8_t security_code = 7;
+    struct timespec start, end;
+    int opt;
+
+    fuzz_seed = time(NULL);
+    while ((opt = getopt(argc, argv, "n:s:")) != -1) {
+        switch (opt) {
+        case 'n':
+            scans = strtoull(optarg, NULL, 10);
+            break;
+        case 's':
+            fuzz_seed = strtoul(optarg, NULL, 10);
+            break;
+        default:
+            fuzz_usage(argv[0]);
+        }
+    }
+    if (optind < argc)
+        fuzz_usage(argv[0]);
+
+    for (uint8_t i = 0; i < FUZZ_HOT_KEYS; i++) {
+        uint32_t r = fuzz_random();
+        hot[i][0] = r % MATRIX_ROWS;
+        hot[i][1] = (r >> 8) % (MATRIX_COLS-1);
+    }
+    fuzz_settings[SETTING_SOLENOID_PULSE] = 5;
+    fuzz_settings[SETTING_SOLENOID_HOLD] = 100;
+
+    debounce_init();
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    for (fuzz_scan = 0; fuzz_scan < scans; fuzz_scan++) {
+        fuzz_time += fuzz_interval();
+        fuzz_mutate(raw, &security_code, (const uint8_t (*)[2])hot);
+        fuzz_scan_matrix(matrix, debounced, debouncing, raw,
+                         security_code, last_edge);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double secs = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec)/1e9;
+
+    printf("seed %u: %llu scans (%.1fs virtual) in %.2fs, %.2fM scans/s\n"
+           "%llu commits, %llu pseudo-key presses, %llu solenoid clicks, %llu beeps: OK\n",
+           fuzz_seed, (unsigned long long)scans, fuzz_time/1000.0, secs,
+           scans/secs/1e6, (unsigned long long)fuzz_stats.commits,
+           (unsigned long long)fuzz_stats.pseudo_keys,
+           (unsigned long long)fuzz_stats.solenoid,
+           (unsigned long long)fuzz_stats.beeps);
+
+    return EXIT_SUCCESS;
+}
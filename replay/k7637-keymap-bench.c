@@ -0,0 +1,202 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Benchmark of the keymap cache (keymap_cache.c).
+ *
+ * Compares the action lookup of TMK's layer_switch_get_action() with
+ * the cache against the uncached lookup of Unimap's default
+ * action_for_key(), which reads unimap_trans and actionmaps once per
+ * active layer.
+ * The keymap resembles unimap_00.c: Layer 0 defines all keys,
+ * layer 1 only one row (the mouse keys) and is transparent otherwise,
+ * layers 2 and 3 are entirely transparent.
+ *
+ * Besides the time per lookup, the number of flash reads per lookup
+ * is counted, which does not depend on the host.
+ * Only the lookup is benchmarked, not the time from a key event to
+ * its report.
+ * The times are host CPU times, not AVR cycles: The host does not
+ * distinguish flash from RAM and caches both tables, so the cache does not
+ * pay off there and the times are dominated by the layer loop.
+ * On the AVR, every flash read (LPM) takes 3 cycles plus the address
+ * calculation of the PROGMEM tables, which is what the cache saves.
+ *
+ * Build and run from the repository root:
+ *
+ *     cc -O2 -Ireplay -include config.h -o k7637-keymap-bench replay/k7637-keymap-bench.c
+ *     ./k7637-keymap-bench
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <time.h>
+
+#include <avr/pgmspace.h>
+
+/** Number of flash reads (see bench_lookup()) */
+static unsigned long bench_flash_reads = 0;
+
+#undef pgm_read_byte
+#undef pgm_read_word
+#define pgm_read_byte(ADDR) (bench_flash_reads++, *(const uint8_t *)(ADDR))
+#define pgm_read_word(ADDR) (bench_flash_reads++, *(const uint16_t *)(ADDR))
+
+#include "../keymap_cache.c"
+
+/** Lookups per measurement */
+#define BENCH_LOOKUPS 10000000UL
+/** Measurements per figure (the fastest one is reported) */
+#define BENCH_RUNS 5
+/** Cache rebuilds per measurement */
+#define BENCH_UPDATES 200000UL
+
+#define BENCH_KEYS(A) \
+    {{.code = (A)+0}, {.code = (A)+1}, {.code = (A)+2}, {.code = (A)+3}, \
+     {.code = (A)+4}, {.code = (A)+5}, {.code = (A)+6}, {.code = (A)+7}, \
+     {.code = (A)+8}, {.code = (A)+9}, {.code = (A)+10}, {.code = (A)+11}, \
+     {.code = (A)+12}, {.code = (A)+13}, {.code = (A)+14}, {.code = (A)+15}}
+#define BENCH_TRNS {[0 ... UNIMAP_COLS-1] = {.code = ACTION_TRANSPARENT}}
+#define BENCH_TRANS(R) \
+    {(R)<<4|0, (R)<<4|1, (R)<<4|2, (R)<<4|3, (R)<<4|4, (R)<<4|5, (R)<<4|6, (R)<<4|7, \
+     (R)<<4|8, (R)<<4|9, (R)<<4|10, (R)<<4|11, (R)<<4|12, (R)<<4|13, (R)<<4|14, (R)<<4|15}
+
+const action_t actionmaps[][UNIMAP_ROWS][UNIMAP_COLS] = {
+    {
+        BENCH_KEYS(0x04), BENCH_KEYS(0x14), BENCH_KEYS(0x24), BENCH_KEYS(0x34),
+        BENCH_KEYS(0x44), BENCH_KEYS(0x54), BENCH_KEYS(0x64), BENCH_KEYS(0x74)
+    },
+    {
+        BENCH_TRNS, BENCH_TRNS, BENCH_TRNS, BENCH_KEYS(0xF000),
+        BENCH_TRNS, BENCH_TRNS, BENCH_TRNS, BENCH_TRNS
+    },
+    /* layers 2 and 3 are entirely transparent */
+    {[0 ... UNIMAP_ROWS-1] = BENCH_TRNS},
+    {[0 ... UNIMAP_ROWS-1] = BENCH_TRNS}
+};
+
+const uint8_t unimap_trans[MATRIX_ROWS][MATRIX_COLS] = {
+    BENCH_TRANS(0), BENCH_TRANS(1), BENCH_TRANS(2), BENCH_TRANS(3),
+    BENCH_TRANS(4), BENCH_TRANS(5), BENCH_TRANS(6), BENCH_TRANS(7)
+};
+
+uint32_t layer_state = 0, default_layer_state = 0;
+
+/* no remapped keys */
+matrix_row_t keymap_overlay_map[MATRIX_ROWS];
+
+bool keymap_overlay_lookup(uint8_t layer, uint8_t row, uint8_t col, action_t *action)
+{
+    (void)layer, (void)row, (void)col, (void)action;
+    return false;
+}
+
+/** Unimap's default action_for_key() */
+static action_t bench_action_for_key(uint8_t layer, keypos_t key)
+{
+    return keymap_lookup(layer, key.row, key.col);
+}
+
+/** TMK's layer_switch_get_action() for the given action_for_key() */
+#define BENCH_LAYER_SWITCH_GET_ACTION(NAME, ACTION_FOR_KEY) \
+    static __attribute__((noinline)) action_t NAME(keypos_t key) \
+    { \
+        action_t action; \
+        uint32_t layers = layer_state | default_layer_state; \
+        for (int8_t i = 31; i >= 0; i--) { \
+            if (layers & (1UL << i)) { \
+                action = ACTION_FOR_KEY(i, key); \
+                if (action.code != ACTION_TRANSPARENT) \
+                    return action; \
+            } \
+        } \
+        return ACTION_FOR_KEY(0, key); \
+    }
+
+BENCH_LAYER_SWITCH_GET_ACTION(bench_cached, action_for_key)
+BENCH_LAYER_SWITCH_GET_ACTION(bench_uncached, bench_action_for_key)
+
+static double bench_now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec*1e9 + ts.tv_nsec;
+}
+
+/**
+ * Measure a lookup function.
+ *
+ * @param row Row of the looked up keys (all columns are looked up in turn).
+ * @param flash_reads Where to store the flash reads per lookup.
+ * @return Time per lookup (ns), the fastest of BENCH_RUNS measurements.
+ */
+static double bench_lookup(action_t (*lookup)(keypos_t), uint8_t row, double *flash_reads)
+{
+    volatile uint16_t sink = 0;
+    double best = 0;
+
+    bench_flash_reads = 0;
+
+    for (int run = 0; run < BENCH_RUNS; run++) {
+        double start = bench_now();
+
+        for (unsigned long i = 0; i < BENCH_LOOKUPS; i++)
+            sink += lookup((keypos_t){.row = row, .col = i & (MATRIX_COLS-1)}).code;
+
+        double time = (bench_now() - start) / BENCH_LOOKUPS;
+        if (!run || time < best)
+            best = time;
+    }
+
+    (void)sink;
+    *flash_reads = (double)bench_flash_reads / (BENCH_RUNS*BENCH_LOOKUPS);
+    return best;
+}
+
+static void bench_layers(const char *name, uint32_t layers, uint8_t row)
+{
+    layer_state = layers;
+    hook_layer_change(layer_state);
+
+    double uncached_reads, cached_reads;
+    double uncached = bench_lookup(bench_uncached, row, &uncached_reads);
+    double cached = bench_lookup(bench_cached, row, &cached_reads);
+
+    printf("%-26s %9.2f %9.2f %9.0f %9.0f\n", name, uncached, cached,
+           uncached_reads, cached_reads);
+}
+
+int main(void)
+{
+    printf("%-26s %9s %9s %9s %9s\n", "", "uncached", "cached", "uncached", "cached");
+    printf("%-26s %9s %9s %9s %9s\n", "lookup", "ns", "ns", "flash rd", "flash rd");
+    bench_layers("layer 0", 0, 0);
+    bench_layers("layer 1, defined", 1 << 1, 3);
+    bench_layers("layer 1, transparent", 1 << 1, 0);
+    bench_layers("layers 1-3, transparent", 0b1110, 0);
+
+    bench_flash_reads = 0;
+    double start = bench_now();
+    for (unsigned long i = 0; i < BENCH_UPDATES; i++)
+        hook_layer_change(layer_state);
+    printf("\ncache rebuild (layers 1-3): %.0f ns, %lu flash reads\n",
+           (bench_now() - start) / BENCH_UPDATES, bench_flash_reads / BENCH_UPDATES);
+
+    return 0;
+}
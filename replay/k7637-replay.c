@@ -0,0 +1,509 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Replay benchmark for the scan and debounce algorithms.
+ *
+ * debounce.c and security_key.c are compiled for the host and fed with
+ * raw matrix captures instead of the real matrix, using a virtual clock.
+ * The matrix scan of matrix.c is mirrored one column at a time, so every
+ * algorithm sees exactly the edges it would have seen on the keyboard.
+ * Every capture is replayed once per debounce algorithm and the following
+ * is reported:
+ *
+ *  - The latency from the first raw edge of a keystroke to its commit.
+ *  - Missed presses and releases, ie. keystrokes that were never committed.
+ *  - Chatter, ie. commits that do not correspond to a keystroke
+ *    (key bounced after the commit or glitches that were not filtered).
+ *  - "Security key" insertions and removals compared to the expected ones.
+ *
+ * The expected keystrokes are derived from the capture itself:
+ * Raw edges of a key less than REPLAY_SETTLE ms apart belong to the
+ * same keystroke and the key's state after the last edge decides whether
+ * the keystroke is a press, a release or just a glitch.
+ *
+ * Capture format (text, see replay/corpus/):
+ *
+ *     # K7637 raw matrix capture
+ *     # scan_us 500
+ *     0 8000 8000 8000 0000 0000 0000 0000 0000
+ *     12000 8000 8000 8000 0000 0010 0000 0000 0000
+ *
+ * Lines starting with `#` are comments, except for `# scan_us`, which is
+ * the scan period the capture was recorded with.
+ * Every other line is the time (us) of a scan followed by the raw state
+ * of all rows as hex column masks (1 if read_row() is true, ie. pressed).
+ * Only scans that changed the state are listed.
+ * Note that the "security key" bits (rows 0-2 of the last column) are set
+ * while no "security key" is inserted.
+ * Captures are recorded on the keyboard with TRACE_ENABLE and
+ * `./k7637-trace.py --capture`.
+ *
+ * Build and run from the repository root:
+ *
+ *     cc -O2 -Ireplay -include config.h -o k7637-replay replay/k7637-replay.c
+ *     ./k7637-replay replay/corpus/synthetic-*.cap
+ *
+ * `-l` replays with LOWLATENCY_ENABLE, `-s` at a different scan period.
+ */
+
+#include <stdint.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/wait.h>
+
+#include "../debounce.c"
+#include "../security_key.c"
+
+/** Raw edges of a key closer than this (ms) belong to one keystroke */
+#define REPLAY_SETTLE 20
+/** Minimum time (ms) a "security key" code must be stable to be expected */
+#define REPLAY_SECURITY_STABLE 500
+/** Time (ms) replayed after the last scan of a capture */
+#define REPLAY_TAIL 500
+
+bool debug_enable = false;
+
+struct replay_scan {
+    uint32_t time;
+    matrix_row_t rows[MATRIX_ROWS];
+};
+
+/** Key event, ie. an expected keystroke or a commit */
+struct replay_event {
+    uint32_t time;
+    uint8_t row, col;
+    bool pressed;
+};
+
+struct replay_events {
+    struct replay_event *events;
+    size_t count, size;
+};
+
+static const struct replay_algorithm {
+    const char *name;
+    /** Fixed debounce window (ms) or 0 for adaptive debouncing */
+    uint8_t fixed;
+} replay_algorithms[] = {
+    {"adaptive", 0},
+    {"fixed 2ms", 2},
+    {"fixed 5ms", 5},
+    {"fixed 10ms", 10}
+};
+
+static struct replay_scan *replay_scans = NULL;
+static size_t replay_scan_count = 0;
+static uint32_t replay_scan_us = 0;
+
+/** Virtual time (us) */
+static uint32_t replay_time = 0;
+
+uint16_t timer_read(void)
+{
+    return replay_time / 1000;
+}
+
+uint32_t timer_read32(void)
+{
+    return replay_time / 1000;
+}
+
+void log_push(const char *fmt, uint16_t a, uint16_t b, uint16_t c, uint16_t d)
+{
+    printf(fmt, a, b, c, d);
+}
+
+static void replay_push(struct replay_events *list, uint32_t time,
+                        uint8_t row, uint8_t col, bool pressed)
+{
+    if (list->count == list->size) {
+        list->size = list->size ? list->size*2 : 256;
+        list->events = realloc(list->events, list->size*sizeof(*list->events));
+        if (!list->events) {
+            perror("realloc");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    list->events[list->count++] = (struct replay_event){time, row, col, pressed};
+}
+
+static bool replay_load(const char *filename)
+{
+    FILE *file = fopen(filename, "r");
+    char line[256];
+    size_t size = 0;
+
+    if (!file) {
+        perror(filename);
+        return false;
+    }
+
+    replay_scan_count = 0;
+    replay_scan_us = 0;
+
+    while (fgets(line, sizeof(line), file)) {
+        struct replay_scan scan;
+        unsigned rows[MATRIX_ROWS];
+
+        if (line[0] == '#') {
+            sscanf(line, "# scan_us %u", &replay_scan_us);
+            continue;
+        }
+        if (sscanf(line, "%u %x %x %x %x %x %x %x %x", &scan.time,
+                   rows+0, rows+1, rows+2, rows+3,
+                   rows+4, rows+5, rows+6, rows+7) != 1+MATRIX_ROWS)
+            continue;
+        if (replay_scan_count && scan.time <= replay_scans[replay_scan_count-1].time) {
+            fprintf(stderr, "%s: Scans out of order at %uus\n", filename, scan.time);
+            fclose(file);
+            return false;
+        }
+        for (uint8_t row = 0; row < MATRIX_ROWS; row++)
+            scan.rows[row] = rows[row];
+
+        if (replay_scan_count == size) {
+            size = size ? size*2 : 256;
+            replay_scans = realloc(replay_scans, size*sizeof(*replay_scans));
+            if (!replay_scans) {
+                perror("realloc");
+                exit(EXIT_FAILURE);
+            }
+        }
+        replay_scans[replay_scan_count++] = scan;
+    }
+
+    fclose(file);
+
+    if (!replay_scan_count || !replay_scan_us) {
+        fprintf(stderr, "%s: Not a raw matrix capture\n", filename);
+        return false;
+    }
+    return true;
+}
+
+static bool replay_is_security_key(uint8_t row, uint8_t col)
+{
+    return col == MATRIX_COLS-1 && row < SECURITY_KEY_ROWS;
+}
+
+static uint8_t replay_security_code(const matrix_row_t rows[])
+{
+    uint8_t code = 0;
+
+    for (uint8_t i = 0; i < 3; i++) {
+        if (!(rows[i] & (1 << (MATRIX_COLS-1))))
+            code |= (1 << i);
+    }
+
+    return code;
+}
+
+/**
+ * Derive the expected keystrokes from the capture.
+ *
+ * @param expected Expected presses and releases.
+ * @return Number of glitches, ie. edges that should be filtered.
+ */
+static unsigned replay_expect(struct replay_events *expected)
+{
+    unsigned glitches = 0;
+
+    for (uint8_t row = 0; row < MATRIX_ROWS; row++) {
+        for (uint8_t col = 0; col < MATRIX_COLS; col++) {
+            matrix_row_t mask = 1 << col;
+            bool state = replay_scans[0].rows[row] & mask;
+            bool group_state = state;
+            uint32_t first = 0, last = 0;
+            bool grouping = false;
+
+            if (replay_is_security_key(row, col))
+                continue;
+
+            for (size_t i = 1; i <= replay_scan_count; i++) {
+                uint32_t time = i < replay_scan_count ? replay_scans[i].time : UINT32_MAX;
+
+                if (grouping && time - last >= REPLAY_SETTLE*1000UL) {
+                    /* keystroke complete */
+                    if (state != group_state)
+                        replay_push(expected, first, row, col, state);
+                    else
+                        glitches++;
+                    grouping = false;
+                }
+                if (i == replay_scan_count ||
+                    !((replay_scans[i].rows[row] ^ replay_scans[i-1].rows[row]) & mask))
+                    continue;
+
+                if (!grouping) {
+                    grouping = true;
+                    group_state = state;
+                    first = time;
+                }
+                last = time;
+                state = !state;
+            }
+        }
+    }
+
+    return glitches;
+}
+
+/**
+ * Count the expected "security key" insertions and removals.
+ */
+static unsigned replay_expect_security(void)
+{
+    uint8_t stable = replay_security_code(replay_scans[0].rows);
+    unsigned events = 0;
+
+    for (size_t i = 1; i < replay_scan_count; i++) {
+        uint8_t code = replay_security_code(replay_scans[i].rows);
+        uint32_t end = i+1 < replay_scan_count ? replay_scans[i+1].time : UINT32_MAX;
+
+        if (code == stable || end - replay_scans[i].time < REPLAY_SECURITY_STABLE*1000UL)
+            continue;
+
+        if ((stable == 0 && 1 <= code && code <= 6) ||
+            (1 <= stable && stable <= 6 && code == 0))
+            events++;
+        stable = code;
+    }
+
+    return events;
+}
+
+/**
+ * Replay the capture like matrix_scan() would scan the matrix.
+ *
+ * The matrix is scanned continuously, one column every `scan_us`/16.
+ * Commits are reported when matrix_scan() returns, ie. after the
+ * scan's last column.
+ * With `low_latency` (LOWLATENCY_ENABLE), the scan returns right after
+ * the first column with a commit and the next scan continues
+ * with the next column.
+ *
+ * @param commits Committed presses and releases.
+ * @return Number of "security key" insertions and removals.
+ */
+static unsigned replay_run(uint32_t scan_us, bool low_latency, struct replay_events *commits)
+{
+    matrix_row_t debouncing[MATRIX_ROWS], debounced[MATRIX_ROWS];
+    uint32_t end = replay_scans[replay_scan_count-1].time + REPLAY_TAIL*1000UL;
+    uint16_t security_key_time = 0;
+    unsigned security_events = 0;
+    size_t next = 1;
+    /* columns read so far */
+    uint64_t cols = 0;
+
+    memcpy(debouncing, replay_scans[0].rows, sizeof(debouncing));
+    memcpy(debounced, replay_scans[0].rows, sizeof(debounced));
+
+    while (replay_time <= end) {
+        /* matrix_scan() */
+        uint16_t now = timer_read();
+        size_t reported = commits->count;
+
+        for (uint8_t i = 0; i < MATRIX_COLS; i++) {
+            uint8_t col = cols++ % MATRIX_COLS;
+            uint8_t row = 0;
+
+            replay_time = cols*scan_us/MATRIX_COLS;
+            while (next < replay_scan_count && replay_scans[next].time <= replay_time)
+                next++;
+            const matrix_row_t *raw = replay_scans[next-1].rows;
+
+            if (col == MATRIX_COLS-1) {
+                if ((uint16_t)(now - security_key_time) >= SECURITY_KEY_INTERVAL) {
+                    security_key_time = now;
+                    if (security_key_update(replay_security_code(raw))) {
+                        matrix_row_t m[MATRIX_ROWS] = {0};
+
+                        security_key_decode(m);
+                        for (uint8_t r = 0; r < SECURITY_KEY_ROWS; r++)
+                            security_events += !!(m[r] & (1 << col));
+                    }
+                }
+                row = SECURITY_KEY_ROWS;
+            }
+
+            for (; row < MATRIX_ROWS; row++) {
+                if (!((debouncing[row] ^ raw[row]) & (1 << col)))
+                    continue;
+                debouncing[row] ^= (1 << col);
+                debounce_edge(row, col, now);
+            }
+
+            uint8_t changed = debounce_col(debounced, debouncing, col, now);
+            for (row = 0; row < MATRIX_ROWS; row++) {
+                if (changed & (1 << row))
+                    replay_push(commits, 0, row, col, debounced[row] & (1 << col));
+            }
+            if (changed && low_latency)
+                break;
+        }
+
+        /* the report is sent when matrix_scan() returns */
+        for (; reported < commits->count; reported++)
+            commits->events[reported].time = replay_time;
+    }
+
+    return security_events;
+}
+
+static void replay_algorithm(const struct replay_algorithm *algorithm,
+                             uint32_t scan_us, bool low_latency,
+                             const struct replay_events *expected, unsigned expected_security)
+{
+    struct replay_events commits = {NULL, 0, 0};
+    unsigned missed_presses = 0, missed_releases = 0, matched = 0;
+    uint64_t latency_sum = 0;
+    uint32_t latency_max = 0;
+
+    debounce_init();
+    debounce_set_fixed(algorithm->fixed);
+    unsigned security_events = replay_run(scan_us, low_latency, &commits);
+
+    for (size_t i = 0; i < expected->count; i++) {
+        const struct replay_event *keystroke = expected->events+i;
+        uint32_t until = UINT32_MAX;
+        bool found = false;
+
+        /* the keystroke must be committed before the key's next keystroke */
+        for (size_t j = i+1; j < expected->count; j++) {
+            if (expected->events[j].row == keystroke->row &&
+                expected->events[j].col == keystroke->col) {
+                until = expected->events[j].time;
+                break;
+            }
+        }
+
+        for (size_t j = 0; j < commits.count; j++) {
+            const struct replay_event *commit = commits.events+j;
+
+            if (commit->row != keystroke->row || commit->col != keystroke->col ||
+                commit->time < keystroke->time || commit->time >= until ||
+                commit->pressed != keystroke->pressed)
+                continue;
+
+            uint32_t latency = commit->time - keystroke->time;
+            latency_sum += latency;
+            if (latency > latency_max)
+                latency_max = latency;
+            matched++;
+            found = true;
+            break;
+        }
+
+        if (!found) {
+            if (keystroke->pressed)
+                missed_presses++;
+            else
+                missed_releases++;
+        }
+    }
+
+    printf("%-12s %8.2f %8.2f %8u %8u %8zu %5u/%u\n", algorithm->name,
+           matched ? latency_sum/1000.0/matched : 0, latency_max/1000.0,
+           missed_presses, missed_releases, commits.count-matched,
+           security_events, expected_security);
+
+    free(commits.events);
+}
+
+static void replay_usage(const char *name)
+{
+    fprintf(stderr, "Usage: %s [-l] [-s scan_us] capture...\n", name);
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char **argv)
+{
+    uint32_t scan_us = 0;
+    bool low_latency = false;
+    int opt;
+    int ret = EXIT_SUCCESS;
+
+    while ((opt = getopt(argc, argv, "ls:")) != -1) {
+        switch (opt) {
+        case 'l':
+            low_latency = true;
+            break;
+        case 's':
+            scan_us = strtoul(optarg, NULL, 10);
+            if (!scan_us)
+                replay_usage(argv[0]);
+            break;
+        default:
+            replay_usage(argv[0]);
+        }
+    }
+    if (optind >= argc)
+        replay_usage(argv[0]);
+
+    for (int i = optind; i < argc; i++) {
+        struct replay_events expected = {NULL, 0, 0};
+        unsigned presses = 0;
+
+        if (!replay_load(argv[i])) {
+            ret = EXIT_FAILURE;
+            continue;
+        }
+
+        unsigned glitches = replay_expect(&expected);
+        unsigned expected_security = replay_expect_security();
+        for (size_t j = 0; j < expected.count; j++)
+            presses += expected.events[j].pressed;
+
+        printf("%s: %zu scans, scan period %uus (replayed at %uus%s)\n"
+               "%u presses, %zu releases, %u glitches\n\n",
+               argv[i], replay_scan_count, replay_scan_us,
+               scan_us ? : replay_scan_us, low_latency ? ", low latency" : "",
+               presses, expected.count-presses, glitches);
+        printf("%-12s %8s %8s %8s %8s %8s %7s\n", "algorithm",
+               "lat avg", "lat max", "miss prs", "miss rel", "chatter", "seckey");
+
+        /*
+         * debounce.c and security_key.c keep their state in static variables,
+         * so every algorithm is replayed in a fresh process.
+         */
+        for (size_t j = 0; j < sizeof(replay_algorithms)/sizeof(*replay_algorithms); j++) {
+            fflush(stdout);
+            pid_t pid = fork();
+
+            if (pid < 0) {
+                perror("fork");
+                return EXIT_FAILURE;
+            }
+            if (!pid) {
+                replay_algorithm(replay_algorithms+j, scan_us ? : replay_scan_us,
+                                 low_latency, &expected, expected_security);
+                exit(EXIT_SUCCESS);
+            }
+            waitpid(pid, NULL, 0);
+        }
+        printf("\n");
+
+        free(expected.events);
+    }
+
+    return ret;
+}
@@ -0,0 +1,19 @@
+/* Host replacement for TMK's keyboard.h used by the host harnesses */
+#ifndef REPLAY_KEYBOARD_H
+#define REPLAY_KEYBOARD_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+typedef struct {
+    uint8_t col;
+    uint8_t row;
+} keypos_t;
+
+typedef struct {
+    keypos_t key;
+    bool pressed;
+    uint16_t time;
+} keyevent_t;
+
+#endif
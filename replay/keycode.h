@@ -0,0 +1,22 @@
+/* Host replacement for TMK's keycode.h used by the host harnesses */
+#ifndef REPLAY_KEYCODE_H
+#define REPLAY_KEYCODE_H
+
+#define IS_KEY(code)    (KC_A <= (code) && (code) <= KC_EXSEL)
+#define IS_MOD(code)    (KC_LCTRL <= (code) && (code) <= KC_RGUI)
+#define MOD_BIT(code)   (1 << ((code) & 0x07))
+
+enum hid_keyboard_keypad_usage {
+    KC_NO = 0x00,
+    KC_A = 0x04,
+    KC_ESCAPE = 0x29,
+    KC_APPLICATION = 0x65,
+    KC_EXSEL = 0xA4,
+    KC_LCTRL = 0xE0,
+    KC_RGUI = 0xE7
+};
+
+#define KC_ESC  KC_ESCAPE
+#define KC_APP  KC_APPLICATION
+
+#endif
@@ -0,0 +1,12 @@
+/* Host replacement for TMK's keymap.h used by the host harnesses */
+#ifndef REPLAY_KEYMAP_H
+#define REPLAY_KEYMAP_H
+
+#include <stdint.h>
+
+#include "action_code.h"
+#include "keyboard.h"
+
+action_t action_for_key(uint8_t layer, keypos_t key);
+
+#endif
@@ -0,0 +1,9 @@
+/* Host replacement for TMK's matrix.h used by the host harnesses */
+#ifndef REPLAY_MATRIX_H
+#define REPLAY_MATRIX_H
+
+#include <stdint.h>
+
+typedef uint16_t matrix_row_t;
+
+#endif
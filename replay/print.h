@@ -0,0 +1,11 @@
+/* Host replacement for TMK's print.h used by the host harnesses */
+#ifndef REPLAY_PRINT_H
+#define REPLAY_PRINT_H
+
+#include <stdio.h>
+
+#define print(S) fputs((S), stdout)
+#define print_hex8(I) printf("%02X", (unsigned)(I))
+#define xprintf printf
+
+#endif
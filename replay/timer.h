@@ -0,0 +1,12 @@
+/* Host replacement for TMK's timer.h used by the host harnesses (virtual clock) */
+#ifndef REPLAY_TIMER_H
+#define REPLAY_TIMER_H
+
+#include <stdint.h>
+
+uint16_t timer_read(void);
+uint32_t timer_read32(void);
+#define timer_elapsed(LAST) ((uint16_t)(timer_read() - (LAST)))
+#define timer_elapsed32(LAST) (timer_read32() - (LAST))
+
+#endif
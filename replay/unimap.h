@@ -0,0 +1,9 @@
+/* Host replacement for TMK's unimap.h used by the host harnesses */
+#ifndef REPLAY_UNIMAP_H
+#define REPLAY_UNIMAP_H
+
+#define UNIMAP_ROWS 8
+#define UNIMAP_COLS 16
+#define UNIMAP_NO   0x7F
+
+#endif
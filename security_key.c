@@ -0,0 +1,134 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "debug.h"
+#include "log.h"
+#include "matrix.h"
+#include "security_key.h"
+
+/*
+ * The first 4 bits in the 15th column (D0-3 while A15 is strobed)
+ * are sensed like ordinary keypresses but
+ * in reality represent a 3-bit "security key"
+ * (cf. Betriebsdokumentation, p.13f) with
+ * an actual resolution of 6 encoded into a special
+ * keylike device that's plugged into the keyboard.
+ * It makes no sense to map these original bits into
+ * the keyboard matrix.
+ * Instead we translate it into one of six key presses
+ * via unused fields of the keyboard matrix whenever
+ * the "security" key is removed.
+ * These pseudo-keypress are mapped to F19-F24 in unimap_trans
+ * and could be mapped at the OS level, eg. to lock up the screen.
+ * When removing the "security key", F18 is also pressed which
+ * will usually be mapped to a modifier but could also be left
+ * F18 and be used to lock up the screen, ignoring all the other
+ * pseudo-keys.
+ *
+ * FIXME: It would be more elegant to directly cause
+ * a key event to be generated, but this does not seem to be
+ * supported if we want to take the configurable keymap into account.
+ * Also, it might be more elegant to have all the pseudo-keys
+ * in a dedicated matrix row.
+ */
+
+/** Number of identical samples before accepting a new "security key" */
+#define SECURITY_KEY_SAMPLES 4
+
+/** Debounced "security key" (0 if none is inserted) */
+static uint8_t security_key = 0;
+/** Previous debounced "security key" */
+static uint8_t security_key_prev = 0;
+
+/**
+ * Debounce a sample of the "security key".
+ *
+ * The "security key" is plugged in only rarely, so it is
+ * sampled at a low rate (every SECURITY_KEY_INTERVAL ms) instead of on
+ * every scan and is not subject to the per-key debouncing.
+ * A new code must be read SECURITY_KEY_SAMPLES times in a row,
+ * so a half-inserted key cannot produce bogus codes.
+ *
+ * @param code The sampled "security key" bits (0 if none is inserted).
+ * @return Whether the debounced "security key" changed.
+ */
+bool security_key_update(uint8_t code)
+{
+    static uint8_t raw = 0, count = SECURITY_KEY_SAMPLES;
+
+    if (code != raw) {
+        raw = code;
+        count = 1;
+        return false;
+    }
+    if (count >= SECURITY_KEY_SAMPLES || ++count < SECURITY_KEY_SAMPLES ||
+        code == security_key)
+        return false;
+
+    security_key_prev = security_key;
+    security_key = code;
+    return true;
+}
+
+/**
+ * Translate a change of the "security key" into pseudo-keys.
+ *
+ * This operates only on the given matrix and the debounced codes,
+ * so it has no hardware dependencies.
+ * It must be called whenever security_key_update() reported a change
+ * and `m` has been refreshed from the debounced state.
+ * It guarantees the following:
+ *
+ *  - Only codes 1-6 ever produce pseudo-keys.
+ *    Any other code (ie. 7) behaves like a removed key, but
+ *    does not generate any event.
+ *  - Every insertion produces exactly one F19-F24 press and every
+ *    removal exactly one F18 press plus the F19-F24 of the removed key.
+ *    Changing the code directly (without passing through 0) is not an event.
+ *
+ * @param m Matrix state to translate.
+ */
+void security_key_decode(matrix_row_t m[])
+{
+    if (security_key_prev == 0 && 1 <= security_key && security_key <= 6) {
+        LOG(MATRIX, INFO, "Security key %u inserted\n", security_key);
+        m[security_key-1] |= (1 << (MATRIX_COLS-1)); /* F19-F24 */
+    } else if (1 <= security_key_prev && security_key_prev <= 6 && security_key == 0) {
+        LOG(MATRIX, INFO, "Security key %u removed\n", security_key_prev);
+        m[0] |= (1 << 13); /* F18 */
+        m[security_key_prev-1] |= (1 << (MATRIX_COLS-1)); /* F19-F24 */
+    }
+}
+
+/**
+ * Release all pseudo-keys.
+ *
+ * Physically inserting or removing the "security key" should
+ * result in a keypress event immediately followed by a keyrelease.
+ * This must therefore be called on every scan that did not
+ * call security_key_decode(), so that the key press is reported
+ * for exactly one scan cycle.
+ */
+void security_key_release(matrix_row_t m[])
+{
+    m[0] &= ~(1 << 13); /* F18 */
+    for (uint8_t i = 0; i < SECURITY_KEY_ROWS; i++)
+        m[i] &= ~(1 << (MATRIX_COLS-1)); /* F19-F24 */
+}
@@ -0,0 +1,38 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SECURITY_KEY_H
+#define SECURITY_KEY_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "matrix.h"
+
+/**
+ * Number of rows in the last column that are not part of the original
+ * keyboard matrix, ie. the "security key" bits and F19-F24.
+ */
+#define SECURITY_KEY_ROWS 6
+/** Interval between samples of the "security key" bits (ms) */
+#define SECURITY_KEY_INTERVAL 50
+
+bool security_key_update(uint8_t code);
+void security_key_decode(matrix_row_t m[]);
+void security_key_release(matrix_row_t m[]);
+
+#endif
@@ -0,0 +1,196 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdbool.h>
+#include <string.h>
+
+#include <avr/eeprom.h>
+#include <avr/pgmspace.h>
+#include <util/crc16.h>
+
+#include "debug.h"
+#include "log.h"
+#include "timer.h"
+#include "keyclick.h"
+#include "settings.h"
+
+/*
+ * The settings are stored in a log of records in EEPROM.
+ * Every record holds the values of all settings, so only the latest record
+ * has to be read at boot time and there is no need for compaction.
+ * Every change is written into the next slot, so the writes are spread
+ * evenly across the entire log and no cell wears out faster than the others.
+ * A record is valid only if its CRC matches, so an interrupted write will
+ * simply leave the previous record in effect.
+ *
+ * Every record has got a sequence number which is also its slot number
+ * (modulo SETTINGS_SLOTS).
+ * The latest record is therefore the last one whose sequence number
+ * continues the one in the first slot, which is found by a binary search.
+ * Booting takes at most log2(SETTINGS_SLOTS)+2 record reads no matter
+ * how often the settings have been saved.
+ */
+
+/** Number of record slots (must be a power of 2) */
+#define SETTINGS_SLOTS 128
+/**
+ * Time (ms) a change must persist before being saved.
+ * This coalesces quickly repeated changes (eg. toggling the keyclick mode)
+ * into a single write.
+ */
+#define SETTINGS_SAVE_DELAY 5000
+
+struct settings_record {
+    uint16_t seq;
+    /** Setting values (reserves space for future settings) */
+    uint8_t values[13];
+    /** CRC8 of all of the above */
+    uint8_t crc;
+};
+
+#define SETTINGS_RECORD(SLOT) \
+    ((struct settings_record *)EEPROM_SETTINGS_ADDR + (SLOT))
+
+static const uint8_t settings_defaults[SETTING_MAX] PROGMEM = {
+    [SETTING_KEYCLICK_MODE] = KEYCLICK_OFF,
+    [SETTING_LED_BRIGHTNESS] = 255,
+    [SETTING_SOLENOID_PULSE] = 5,
+    [SETTING_SOLENOID_HOLD] = 30,
+    [SETTING_SCAN_PROFILE] = 0,
+    [SETTING_MOUSE_CURVE] = 0
+};
+
+/** Current values (may be newer than the latest record) */
+static uint8_t settings_values[SETTING_MAX];
+
+/** Slot of the latest valid record */
+static uint8_t settings_slot = SETTINGS_SLOTS-1;
+/** Sequence number of the latest valid record */
+static uint16_t settings_seq = 0xFFFF;
+
+static bool settings_dirty = false;
+static uint16_t settings_dirty_time;
+
+/** Record currently being written */
+static struct settings_record settings_record;
+/** Next byte of `settings_record` to write or 0xFF if not writing */
+static uint8_t settings_write_pos = 0xFF;
+
+static uint8_t settings_crc(const struct settings_record *record)
+{
+    uint8_t crc = 0;
+
+    for (uint8_t i = 0; i < offsetof(struct settings_record, crc); i++)
+        crc = _crc8_ccitt_update(crc, ((const uint8_t *)record)[i]);
+
+    return crc;
+}
+
+static bool settings_read(uint8_t slot, struct settings_record *record)
+{
+    eeprom_read_block(record, SETTINGS_RECORD(slot), sizeof(*record));
+    return settings_crc(record) == record->crc;
+}
+
+void settings_init(void)
+{
+    struct settings_record record;
+
+    for (uint8_t i = 0; i < SETTING_MAX; i++)
+        settings_values[i] = pgm_read_byte(&settings_defaults[i]);
+
+    if (settings_read(0, &record)) {
+        uint16_t first_seq = record.seq;
+        uint8_t lo = 0;
+        uint16_t hi = SETTINGS_SLOTS;
+
+        /* `lo` continues the sequence, `hi` does not */
+        while (hi - lo > 1) {
+            uint8_t mid = (lo + hi) / 2;
+
+            if (settings_read(mid, &record) && record.seq == (uint16_t)(first_seq + mid))
+                lo = mid;
+            else
+                hi = mid;
+        }
+
+        settings_slot = lo;
+        settings_seq = first_seq + lo;
+    } else if (settings_read(SETTINGS_SLOTS-1, &record)) {
+        /* writing the first slot was interrupted after the log wrapped */
+        settings_slot = SETTINGS_SLOTS-1;
+        settings_seq = record.seq;
+    } else {
+        LOG(SETTINGS, ERROR, "No settings found\n");
+        return;
+    }
+
+    settings_read(settings_slot, &record);
+    memcpy(settings_values, record.values, sizeof(settings_values));
+}
+
+uint8_t settings_get(enum setting key)
+{
+    return settings_values[key];
+}
+
+void settings_set(enum setting key, uint8_t value)
+{
+    if (settings_values[key] == value)
+        return;
+
+    settings_values[key] = value;
+    settings_dirty = true;
+    settings_dirty_time = timer_read();
+}
+
+/**
+ * Save changed settings.
+ *
+ * This is called from the keyboard loop and writes at most one byte at a time
+ * without waiting for the EEPROM, so that scanning is not delayed.
+ */
+void settings_task(void)
+{
+    if (settings_write_pos == 0xFF) {
+        if (!settings_dirty || timer_elapsed(settings_dirty_time) < SETTINGS_SAVE_DELAY)
+            return;
+        settings_dirty = false;
+
+        memset(&settings_record, 0xFF, sizeof(settings_record));
+        settings_record.seq = settings_seq+1;
+        memcpy(settings_record.values, settings_values, sizeof(settings_values));
+        settings_record.crc = settings_crc(&settings_record);
+        settings_write_pos = 0;
+    }
+
+    if (!eeprom_is_ready())
+        return;
+
+    uint8_t slot = (settings_slot+1) % SETTINGS_SLOTS;
+    eeprom_update_byte((uint8_t *)SETTINGS_RECORD(slot) + settings_write_pos,
+                       ((uint8_t *)&settings_record)[settings_write_pos]);
+
+    if (++settings_write_pos < sizeof(settings_record))
+        return;
+
+    settings_slot = slot;
+    settings_seq = settings_record.seq;
+    settings_write_pos = 0xFF;
+}
@@ -0,0 +1,50 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include <stdint.h>
+
+/**
+ * Persistent settings.
+ *
+ * @note New settings must be appended, so that existing
+ * EEPROM contents stay valid.
+ */
+enum setting {
+    SETTING_KEYCLICK_MODE = 0,
+    /** Brightness of the PWM-controlled lock lights */
+    SETTING_LED_BRIGHTNESS,
+    /** Full-power pull-in time of the solenoid (ms) */
+    SETTING_SOLENOID_PULSE,
+    /** Hold duty cycle of the solenoid (percent) */
+    SETTING_SOLENOID_HOLD,
+    /** Selected scan profile (see profile.h) */
+    SETTING_SCAN_PROFILE,
+    /** Selected mouse key acceleration curve (see mouse.h) */
+    SETTING_MOUSE_CURVE,
+    /** not a real setting */
+    SETTING_MAX
+};
+
+void settings_init(void);
+uint8_t settings_get(enum setting key);
+void settings_set(enum setting key, uint8_t value);
+void settings_task(void);
+
+#endif
@@ -0,0 +1,168 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include <avr/io.h>
+
+#include "tick.h"
+#include "log.h"
+#include "pwm.h"
+#include "sof_align.h"
+
+/*
+ * Alignment of matrix scans to the USB start-of-frame (SOF).
+ *
+ * The host polls the keyboard endpoint once per 1ms frame.
+ * Without alignment, a change is committed at a random time within
+ * the frame, so its latency until the next poll varies by up to 1ms.
+ * Instead, we start every scan, so that it ends SOF_ALIGN_LEAD before
+ * the next SOF and the resulting report is ready right before the
+ * host polls.
+ *
+ * The SOF interrupt is handled by TMK's USB stack, so we watch the frame
+ * number (UDFNUML) instead.
+ * Whenever it changes while we are busy waiting for the next scan,
+ * the SOF timestamp is known within SOF_ALIGN_PRECISION.
+ * This happens on every frame as long as the keyboard loop needs less than
+ * SOF_ALIGN_LEAD after a scan, which keeps the phase locked although
+ * the host's and our clocks drift apart.
+ *
+ * NOTE: It has not been measured on hardware yet whether this
+ * actually narrows the spread of the lead times (see sof_align_scan_done()).
+ */
+
+/**
+ * Time (us) between the end of a scan and the next SOF.
+ * This must cover generating and sending the report.
+ */
+#ifndef SOF_ALIGN_LEAD
+#   define SOF_ALIGN_LEAD 100
+#endif
+
+/** Frame length (ticks) */
+#define SOF_ALIGN_FRAME         (1000/TICK_US)
+/** Maximum uncertainty (ticks) of a SOF timestamp */
+#define SOF_ALIGN_PRECISION     4
+/**
+ * Maximum age (ticks) of the last SOF timestamp.
+ * The clocks may drift by up to 0.05%, ie. 32us within 64ms.
+ */
+#define SOF_ALIGN_STALE         (64*SOF_ALIGN_FRAME)
+
+static bool sof_align_locked = false;
+/** Tick of the last SOF detected precisely */
+static uint32_t sof_align_tick;
+static uint8_t sof_align_frame;
+/** Tick of the last frame number poll */
+static uint32_t sof_align_polled;
+/** Tick at which the current scan started */
+static uint32_t sof_align_scan_start;
+/** Duration of a scan (ticks), following increases immediately */
+static uint16_t sof_align_scan_ticks = 0;
+
+static void sof_align_poll(void)
+{
+    uint8_t frame = UDFNUML;
+    uint32_t now = tick_read();
+
+    if (frame != sof_align_frame) {
+        sof_align_frame = frame;
+        if (now - sof_align_polled <= SOF_ALIGN_PRECISION) {
+            sof_align_tick = now - (now - sof_align_polled)/2;
+            sof_align_locked = true;
+        }
+    }
+
+    sof_align_polled = now;
+}
+
+/**
+ * Wait until the next scan should start.
+ *
+ * If the phase is not locked, this polls for the next SOF for at most
+ * two frames, so that we never hang if USB is not running (eg. suspended).
+ *
+ * @return Whether we waited.
+ */
+bool sof_align_wait(void)
+{
+#ifdef BREATHING_LED_ENABLE
+    /* USB is suspended, so there are no SOFs */
+    if (pwm_breathing) {
+        sof_align_scan_start = tick_read();
+        return false;
+    }
+#endif
+
+    sof_align_poll();
+
+    if (sof_align_locked && sof_align_polled - sof_align_tick > SOF_ALIGN_STALE)
+        sof_align_locked = false;
+
+    if (!sof_align_locked) {
+        uint32_t start = sof_align_polled;
+
+        do
+            sof_align_poll();
+        while (!sof_align_locked && sof_align_polled - start < 2*SOF_ALIGN_FRAME);
+
+        if (!sof_align_locked) {
+            sof_align_scan_start = sof_align_polled;
+            return false;
+        }
+    }
+
+    /* ticks from the start of a scan to the next SOF */
+    uint16_t offset = SOF_ALIGN_LEAD/TICK_US + sof_align_scan_ticks;
+    uint16_t phase = (sof_align_polled + offset - sof_align_tick) % SOF_ALIGN_FRAME;
+    uint32_t start = sof_align_polled + (SOF_ALIGN_FRAME - phase) % SOF_ALIGN_FRAME;
+
+    while ((int32_t)(start - sof_align_polled) > 0)
+        sof_align_poll();
+
+    sof_align_scan_start = sof_align_polled;
+    return true;
+}
+
+/**
+ * Account for a finished scan.
+ * Must only be called for scans started by sof_align_wait().
+ *
+ * @param changed Whether a change was committed by the scan.
+ */
+void sof_align_scan_done(bool changed)
+{
+    uint32_t now = tick_read();
+    uint32_t duration = now - sof_align_scan_start;
+
+    /* scans cannot be aligned anyway if they take longer than a frame */
+    if (duration > SOF_ALIGN_FRAME)
+        duration = SOF_ALIGN_FRAME;
+
+    /* decays slowly, so a single fast scan does not make the next one late */
+    if (duration >= sof_align_scan_ticks)
+        sof_align_scan_ticks = duration;
+    else
+        sof_align_scan_ticks--;
+
+    /* the actual lead of committed changes (its jitter is the report jitter) */
+    if (changed && sof_align_locked)
+        LOG(MATRIX, DEBUG, "Committed %u us before SOF\n",
+            (SOF_ALIGN_FRAME - (now - sof_align_tick) % SOF_ALIGN_FRAME) * TICK_US);
+}
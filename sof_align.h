@@ -0,0 +1,36 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef SOF_ALIGN_H
+#define SOF_ALIGN_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#ifdef SOF_ALIGN_ENABLE
+
+bool sof_align_wait(void);
+void sof_align_scan_done(bool changed);
+
+#else
+
+#define sof_align_wait() false
+#define sof_align_scan_done(changed)
+
+#endif
+
+#endif
@@ -48,160 +48,163 @@ static void delay_long(uint16_t ms)
 }
 
 struct song_note {
-    uint16_t freq;
+    /** MIDI note number or PWM_NOTE_OFF for pauses */
+    uint8_t note;
     uint16_t dur;
 };
 
-// midicsv anthem_ddr.mid | perl midicsv2frequency.pl
+// midicsv anthem_ddr.mid | perl midicsv2frequency.pl (converted to MIDI notes)
 static const struct song_note song_ruinen[] PROGMEM = {
-    {440,585},
-    {440,459},
+    {69,585},
+    {69,459},
     {0,585},
     {0,156},
-    {391,500},
+    {67,500},
     {0,100},
-    {349,500},
+    {65,500},
     {0,100},
-    {466,1044},
+    {70,1044},
     {0,156},
-    {440,500},
+    {69,500},
     {0,100},
-    {391,500},
+    {67,500},
     {0,100},
-    {523,500},
+    {72,500},
     {0,100},
-    {440,500},
+    {69,500},
     {0,100},
-    {349,500},
+    {65,500},
     {0,100},
-    {523,500},
+    {72,500},
     {0,100},
-    {523,800},
+    {72,800},
     {0,100},
-    {587,294},
+    {74,294},
     {0,6},
-    {466,1044},
+    {70,1044},
     {0,156},
-    {440,1044},
+    {69,1044},
     {0,156},
-    {391,500},
+    {67,500},
     {0,100},
-    {349,500},
+    {65,500},
     {0,100},
-    {466,1044},
+    {70,1044},
     {0,156},
-    {440,500},
+    {69,500},
     {0,100},
-    {391,500},
+    {67,500},
     {0,100},
-    {523,500},
+    {72,500},
     {0,100},
-    {440,500},
+    {69,500},
     {0,100},
-    {587,500},
+    {74,500},
     {0,100},
-    {466,500},
+    {70,500},
     {0,100},
-    {391,800},
+    {67,800},
     {0,100},
-    {329,294},
+    {64,294},
     {0,6},
-    {349,1700},
+    {65,1700},
     {0,100},
-    {349,444},
+    {65,444},
     {0,6},
-    {329,144},
+    {64,144},
     {0,6},
-    {293,800},
+    {62,800},
     {0,100},
-    {329,294},
+    {64,294},
     {0,6},
-    {349,800},
+    {65,800},
     {0,100},
-    {440,294},
+    {69,294},
     {0,6},
-    {391,500},
+    {67,500},
     {0,100},
-    {261,1100},
+    {60,1100},
     {0,100},
-    {349,444},
+    {65,444},
     {0,6},
-    {329,144},
+    {64,144},
     {0,6},
-    {293,800},
+    {62,800},
     {0,100},
-    {329,294},
+    {64,294},
     {0,6},
-    {349,800},
+    {65,800},
     {0,100},
-    {440,294},
+    {69,294},
     {0,6},
-    {391,1044},
+    {67,1044},
     {0,156},
-    {440,500},
+    {69,500},
     {0,100},
-    {440,500},
+    {69,500},
     {0,100},
-    {391,500},
+    {67,500},
     {0,100},
-    {349,500},
+    {65,500},
     {0,100},
-    {466,500},
+    {70,500},
     {0,100},
-    {466,500},
+    {70,500},
     {0,100},
-    {440,500},
+    {69,500},
     {0,100},
-    {391,500},
+    {67,500},
     {0,100},
-    {523,500},
+    {72,500},
     {0,100},
-    {440,500},
+    {69,500},
     {0,100},
-    {349,500},
+    {65,500},
     {0,100},
-    {523,500},
+    {72,500},
     {0,100},
-    {523,800},
+    {72,800},
     {0,100},
-    {587,294},
+    {74,294},
     {0,6},
-    {466,500},
+    {70,500},
     {0,100},
-    {349,294},
+    {65,294},
     {0,6},
-    {391,294},
+    {67,294},
     {0,6},
-    {440,1044},
+    {69,1044},
     {0,156},
-    {391,1044},
+    {67,1044},
     {0,156},
-    {523,1044},
+    {72,1044},
     {0,156},
-    {349,500},
+    {65,500},
     {0,100},
-    {391,500},
+    {67,500},
     {0,100},
-    {440,1044},
+    {69,1044},
     {0,156},
-    {391,1044},
+    {67,1044},
     {0,156},
-    {349,1044}
+    {65,1044}
 };
 
 void song_play_ruinen(void)
 {
     /* could be activated due to keyclick mode */
-    keyclick_solenoid_set(false);
-    pwm_pd0_set_tone(0);
+    pwm_pb3_solenoid_off();
+    pwm_pd0_set_note(PWM_NOTE_OFF, 0);
 
     uint8_t i = 0;
     for (long unsigned int cur_note = 0; cur_note < sizeof(song_ruinen)/sizeof(song_ruinen[0]); cur_note++) {
         uint16_t cur_note_time = timer_read();
 
-        pwm_pd0_set_tone(pgm_read_word(&song_ruinen[cur_note].freq));
+        uint8_t note = pgm_read_byte(&song_ruinen[cur_note].note);
+        pwm_pd0_set_note(note, 0);
 
-        uint8_t max_brightness = ((uint32_t)pgm_read_word(&song_ruinen[cur_note].freq)*255)/600;
+        /* the song's range is C4 (60) to D5 (74) */
+        uint8_t max_brightness = note > 50 ? (note-50)*10 : 0;
         uint16_t fade_dur = pgm_read_word(&song_ruinen[cur_note].dur)/2/(max_brightness+1);
         for (int16_t brightness = 0; brightness <= max_brightness; brightness++) {
             pwm_set_led(i % 5, brightness);
@@ -213,7 +216,7 @@ void song_play_ruinen(void)
             delay_long(fade_dur);
         }
 
-        if (pgm_read_word(&song_ruinen[cur_note].freq))
+        if (note)
             i++;
 
         /* The fade duration is probably not very precise, so compensate for it. */
@@ -222,7 +225,7 @@ void song_play_ruinen(void)
             delay_long(pgm_read_word(&song_ruinen[cur_note].dur) - elapsed);
     }
 
-    pwm_pd0_set_tone(0);
+    pwm_pd0_set_note(PWM_NOTE_OFF, 0);
 
     /* restore the previous lock lights */
     led_set(host_keyboard_leds());
@@ -234,136 +237,136 @@ static const struct song_note song_knight_rider[] PROGMEM = {
     // 16e, 16e, 16e, 16d, 16p, 16e, 16d, 16d, 16p, 16e, 16d, 16e, 16d, 16d, 16d, 16c, 16d, 16d,
     // 16d, 16d, 16p, 16e, 16d, 16d, 16p, 16e, 16d, 16e, 16d, 16d, 16d, 16c, 16d, 16d, 16d
     {0, 480},
-    {330, 480},
+    {64, 480},
     {0, 120},
-    {349, 120},
-    {330, 120},
-    {330, 120},
+    {65, 120},
+    {64, 120},
+    {64, 120},
     {0, 120},
-    {330, 120},
-    {330, 120},
-    {349, 120},
-    {330, 120},
-    {330, 120},
-    {330, 120},
-    {311, 120},
-    {330, 120},
-    {330, 120},
-    {330, 120},
-    {330, 120},
+    {64, 120},
+    {64, 120},
+    {65, 120},
+    {64, 120},
+    {64, 120},
+    {64, 120},
+    {63, 120},
+    {64, 120},
+    {64, 120},
+    {64, 120},
+    {64, 120},
     {0, 120},
-    {349, 120},
-    {330, 120},
-    {330, 120},
+    {65, 120},
+    {64, 120},
+    {64, 120},
     {0, 120},
-    {349, 120},
-    {330, 120},
-    {349, 120},
-    {330, 120},
-    {330, 120},
-    {330, 120},
-    {311, 120},
-    {330, 120},
-    {330, 120},
-    {330, 120},
-    {294, 120},
+    {65, 120},
+    {64, 120},
+    {65, 120},
+    {64, 120},
+    {64, 120},
+    {64, 120},
+    {63, 120},
+    {64, 120},
+    {64, 120},
+    {64, 120},
+    {62, 120},
     {0, 120},
-    {330, 120},
-    {294, 120},
-    {294, 120},
+    {64, 120},
+    {62, 120},
+    {62, 120},
     {0, 120},
-    {330, 120},
-    {294, 120},
-    {330, 120},
-    {294, 120},
-    {294, 120},
-    {294, 120},
-    {262, 120},
-    {294, 120},
-    {294, 120},
-    {294, 120},
-    {294, 120},
+    {64, 120},
+    {62, 120},
+    {64, 120},
+    {62, 120},
+    {62, 120},
+    {62, 120},
+    {60, 120},
+    {62, 120},
+    {62, 120},
+    {62, 120},
+    {62, 120},
     {0, 120},
-    {330, 120},
-    {294, 120},
-    {294, 120},
+    {64, 120},
+    {62, 120},
+    {62, 120},
     {0, 120},
-    {330, 120},
-    {294, 120},
-    {330, 120},
-    {294, 120},
-    {294, 120},
-    {294, 120},
-    {262, 120},
-    {294, 120},
-    {294, 120},
+    {64, 120},
+    {62, 120},
+    {64, 120},
+    {62, 120},
+    {62, 120},
+    {62, 120},
+    {60, 120},
+    {62, 120},
+    {62, 120},
 
     // KnightRider:d=4, o=5, b=63:16e, 32f, 32e, 8b, 16e6, 32f6, 32e6, 8b, 16e, 32f, 32e, 16b,
     // 16e6, d6, 8p, p, 16e, 32f, 32e, 8b, 16e6, 32f6, 32e6, 8b, 16e, 32f, 32e, 16b, 16e6, f6, p
     {0, 952},
-    {330, 952},
-    {349, 119},
-    {330, 119},
-    {494, 476},
-    {659, 238},
-    {698, 119},
-    {659, 119},
-    {494, 476},
-    {330, 238},
-    {349, 119},
-    {330, 119},
-    {494, 238},
-    {659, 238},
-    {587, 952},
+    {64, 952},
+    {65, 119},
+    {64, 119},
+    {71, 476},
+    {76, 238},
+    {77, 119},
+    {76, 119},
+    {71, 476},
+    {64, 238},
+    {65, 119},
+    {64, 119},
+    {71, 238},
+    {76, 238},
+    {74, 952},
     {0, 476},
     {0, 952},
-    {330, 238},
-    {349, 119},
-    {330, 119},
-    {494, 476},
-    {659, 238},
-    {698, 119},
-    {659, 119},
-    {494, 476},
-    {330, 238},
-    {349, 119},
-    {330, 119},
-    {494, 238},
-    {659, 238},
-    {698, 952}
+    {64, 238},
+    {65, 119},
+    {64, 119},
+    {71, 476},
+    {76, 238},
+    {77, 119},
+    {76, 119},
+    {71, 476},
+    {64, 238},
+    {65, 119},
+    {64, 119},
+    {71, 238},
+    {76, 238},
+    {77, 952}
 
 #if 0
     {0, 952},
-    {659, 952},
-    {698, 119},
-    {659, 119},
-    {988, 476},
-    {1319, 238},
-    {1397, 119},
-    {1319, 119},
-    {988, 476},
-    {659, 238},
-    {698, 119},
-    {659, 119},
-    {988, 238},
-    {1319, 238},
-    {1175, 952},
+    {76, 952},
+    {77, 119},
+    {76, 119},
+    {83, 476},
+    {88, 238},
+    {89, 119},
+    {88, 119},
+    {83, 476},
+    {76, 238},
+    {77, 119},
+    {76, 119},
+    {83, 238},
+    {88, 238},
+    {86, 952},
     {0, 476},
     {0, 952},
-    {659, 238},
-    {698, 119},
-    {659, 119},
-    {988, 476},
-    {1319, 238},
-    {1397, 119},
-    {1319, 119},
-    {988, 476},
-    {659, 238},
-    {698, 119},
-    {659, 119},
-    {988, 238},
-    {1319, 238},
-    {1397, 952}
+    {76, 238},
+    {77, 119},
+    {76, 119},
+    {83, 476},
+    {88, 238},
+    {89, 119},
+    {88, 119},
+    {83, 476},
+    {76, 238},
+    {77, 119},
+    {76, 119},
+    {83, 238},
+    {88, 238},
+    {89, 952}
 #endif
 };
 
@@ -399,7 +402,7 @@ static void song_larsen_light(int16_t pos)
 {
     for (uint8_t led = 0; led < 5; led++) {
         int16_t offset = sizeof(song_larsen_curve)*(2+led)/4 - pos;
-        pwm_set_led(led, 0 <= offset && offset < sizeof(song_larsen_curve)
+        pwm_set_led(led, 0 <= offset && offset < (int16_t)sizeof(song_larsen_curve)
                              ? pgm_read_byte(&song_larsen_curve[offset]) : 0);
     }
 
@@ -409,8 +412,8 @@ static void song_larsen_light(int16_t pos)
 void song_play_kitt(void)
 {
     /* could be activated due to keyclick mode */
-    keyclick_solenoid_set(false);
-    pwm_pd0_set_tone(0);
+    pwm_pb3_solenoid_off();
+    pwm_pd0_set_note(PWM_NOTE_OFF, 0);
 
     int16_t i;
 
@@ -423,7 +426,7 @@ void song_play_kitt(void)
 
     int8_t dir = 1;
     for (i = 0; cur_note < sizeof(song_knight_rider)/sizeof(song_knight_rider[0]); i += dir) {
-        pwm_pd0_set_tone(pgm_read_word(&song_knight_rider[cur_note].freq));
+        pwm_pd0_set_note(pgm_read_byte(&song_knight_rider[cur_note].note), 0);
 
         song_larsen_light(i);
 
@@ -436,10 +439,10 @@ void song_play_kitt(void)
         }
     }
 
-    pwm_pd0_set_tone(0);
+    pwm_pd0_set_note(PWM_NOTE_OFF, 0);
 
     /* fade out larsen light */
-    while (i < sizeof(song_larsen_curve)*3/2)
+    while (i < (int16_t)sizeof(song_larsen_curve)*3/2)
         song_larsen_light(i++);
 
     /* restore the previous lock lights */
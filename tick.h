@@ -0,0 +1,58 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TICK_H
+#define TICK_H
+
+#include <stdint.h>
+
+#include <avr/io.h>
+#include <avr/interrupt.h>
+
+#include "timer.h"
+
+/**
+ * Length of a tick in microseconds.
+ *
+ * TMK's timer runs Timer 0 in CTC mode with a prescaler of 64 and
+ * counts milliseconds in its compare match interrupt.
+ * TCNT0 therefore counts in 4us steps (at 16 MHz).
+ */
+#define TICK_US (64*1000000UL/F_CPU)
+
+/**
+ * Read a high-resolution timestamp.
+ *
+ * @return Ticks (TICK_US) since the timer was initialized.
+ */
+static inline uint32_t
+tick_read(void)
+{
+	uint8_t sreg = SREG;
+	cli();
+
+	uint32_t ms = timer_count;
+	uint8_t raw = TCNT0;
+	/* TCNT0 might have wrapped before we disabled interrupts */
+	if ((TIFR0 & (1 << OCF0A)) && raw < OCR0A/2)
+		ms++;
+
+	SREG = sreg;
+	return ms*(OCR0A+1) + raw;
+}
+
+#endif
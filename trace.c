@@ -0,0 +1,143 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdint.h>
+#include <stdbool.h>
+
+#include "print.h"
+#include "tick.h"
+#include "trace.h"
+
+/**
+ * A single traced matrix event.
+ *
+ * This is written to the console as 8 hex digits in the byte order below
+ * and decoded by ./k7637-trace.py.
+ */
+struct trace_record {
+    /**
+     * Bit 7 is set for key presses.
+     * Bits 0-6 encode the matrix position (row << 4 | col).
+     * For TRACE_LOST records, this is the number of dropped events instead
+     * or 0 for the end of a matrix scan (see trace_scan()).
+     */
+    uint8_t key;
+    /** Bits 6-7: enum trace_outcome */
+    uint8_t flags;
+    /** Ticks (TICK_US) since the previous record, saturated at 0xFFFF */
+    uint16_t delta;
+};
+
+/** Number of records in the ring buffer (power of 2) */
+#define TRACE_SIZE 64
+/** Maximum number of records drained per keyboard loop iteration */
+#define TRACE_DRAIN 4
+
+bool trace_enable = false;
+
+static struct trace_record trace_buffer[TRACE_SIZE];
+static uint8_t trace_head = 0, trace_tail = 0;
+static uint8_t trace_lost = 0;
+static uint32_t trace_last_tick = 0;
+/** Whether raw edges were traced since the last scan marker */
+static bool trace_scanned = false;
+
+static bool trace_push(uint8_t key, enum trace_outcome outcome)
+{
+    if ((uint8_t)(trace_head - trace_tail) >= TRACE_SIZE)
+        return false;
+
+    uint32_t now = tick_read();
+    uint32_t delta = now - trace_last_tick;
+    trace_last_tick = now;
+
+    struct trace_record *record = trace_buffer + trace_head % TRACE_SIZE;
+    record->key = key;
+    record->flags = outcome << 6;
+    record->delta = delta > 0xFFFF ? 0xFFFF : delta;
+    trace_head++;
+
+    return true;
+}
+
+static void trace_record(uint8_t key, enum trace_outcome outcome)
+{
+    /*
+     * Dropped events are accounted for by a TRACE_LOST record
+     * as soon as there is room again.
+     */
+    if (trace_lost) {
+        if (!trace_push(trace_lost, TRACE_LOST)) {
+            if (trace_lost < 0xFF)
+                trace_lost++;
+            return;
+        }
+        trace_lost = 0;
+    }
+
+    if (!trace_push(key, outcome))
+        trace_lost++;
+}
+
+void trace_event(uint8_t row, uint8_t col, bool pressed, enum trace_outcome outcome)
+{
+    if (!trace_enable)
+        return;
+
+    if (outcome == TRACE_RAW)
+        trace_scanned = true;
+    trace_record((pressed ? 0x80 : 0) | row << 4 | col, outcome);
+}
+
+/**
+ * Mark the end of a matrix scan.
+ *
+ * This must be called after every scan, so that the raw edges can be
+ * grouped into the scans that sampled them (see `./k7637-trace.py --capture`).
+ * Scans without raw edges are not marked to save buffer space.
+ */
+void trace_scan(void)
+{
+    if (!trace_enable || !trace_scanned)
+        return;
+
+    trace_scanned = false;
+    trace_record(0, TRACE_LOST);
+}
+
+/**
+ * Drain the trace buffer to the console.
+ *
+ * This writes at most TRACE_DRAIN records per call, so that
+ * key event delivery is not delayed noticeably.
+ */
+void trace_task(void)
+{
+    if (trace_head == trace_tail)
+        return;
+
+    print("T:");
+    for (uint8_t i = 0; i < TRACE_DRAIN && trace_tail != trace_head; i++, trace_tail++) {
+        const struct trace_record *record = trace_buffer + trace_tail % TRACE_SIZE;
+
+        print_hex8(record->key);
+        print_hex8(record->flags);
+        print_hex8(record->delta >> 8);
+        print_hex8(record->delta & 0xFF);
+    }
+    print("\n");
+}
@@ -0,0 +1,54 @@
+/*
+Copyright 2021 Robin Haberkorn <robin.haberkorn@googlemail.com>
+
+This program is free software: you can redistribute it and/or modify
+it under the terms of the GNU General Public License as published by
+the Free Software Foundation, either version 2 of the License, or
+(at your option) any later version.
+
+This program is distributed in the hope that it will be useful,
+but WITHOUT ANY WARRANTY; without even the implied warranty of
+MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+GNU General Public License for more details.
+
+You should have received a copy of the GNU General Public License
+along with this program.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+#include <stdbool.h>
+
+enum trace_outcome {
+    /** Raw edge as seen by the matrix scan */
+    TRACE_RAW = 0,
+    /** Change committed by the debouncer */
+    TRACE_COMMIT,
+    /** Key bounced back before its debounce window elapsed */
+    TRACE_FILTERED,
+    /**
+     * Events were dropped since the buffer was full.
+     * Records without dropped events mark the end of a matrix scan instead.
+     */
+    TRACE_LOST
+};
+
+#ifdef TRACE_ENABLE
+
+extern bool trace_enable;
+
+void trace_event(uint8_t row, uint8_t col, bool pressed, enum trace_outcome outcome);
+void trace_scan(void);
+void trace_task(void);
+
+#else
+
+#define trace_event(row, col, pressed, outcome)
+#define trace_scan()
+#define trace_task()
+
+#endif
+
+#endif
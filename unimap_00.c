@@ -17,7 +17,36 @@ along with this program.  If not, see <http://www.gnu.org/licenses/>.
 #include <avr/pgmspace.h>
 
 #include "action_code.h"
+#include "report.h"
 #include "unimap_trans.h"
+#include "mouse.h"
+
+/*
+ * ET1 and ET2 are dual-role keys (see dualrole.c):
+ * They act as LCTRL and RALT when held together with other keys
+ * (also for the command key combination) and as Esc and App when tapped.
+ */
+#define AC_ET1 ACTION_MODS_TAP_KEY(MOD_LCTL, KC_ESC)
+#define AC_ET2 ACTION_MODS_TAP_KEY(MOD_RALT, KC_APP)
+
+/*
+ * The otherwise unused key right of P6 toggles the mouse keys
+ * on the numeric keypad (layer 1, see mouse.c).
+ */
+#define AC_MOUS ACTION_LAYER_TOGGLE(1)
+#define AC_MS_7 ACTION_MOUSE_MOVE(MOUSE_UP | MOUSE_LEFT)
+#define AC_MS_8 ACTION_MOUSE_MOVE(MOUSE_UP)
+#define AC_MS_9 ACTION_MOUSE_MOVE(MOUSE_UP | MOUSE_RIGHT)
+#define AC_MS_4 ACTION_MOUSE_MOVE(MOUSE_LEFT)
+#define AC_MS_6 ACTION_MOUSE_MOVE(MOUSE_RIGHT)
+#define AC_MS_1 ACTION_MOUSE_MOVE(MOUSE_DOWN | MOUSE_LEFT)
+#define AC_MS_2 ACTION_MOUSE_MOVE(MOUSE_DOWN)
+#define AC_MS_3 ACTION_MOUSE_MOVE(MOUSE_DOWN | MOUSE_RIGHT)
+#define AC_MS_B1 ACTION_MOUSE_BUTTON(MOUSE_BTN1)
+#define AC_MS_B2 ACTION_MOUSE_BUTTON(MOUSE_BTN2)
+#define AC_MS_B3 ACTION_MOUSE_BUTTON(MOUSE_BTN3)
+#define AC_MS_WU ACTION_MOUSE_WHEEL(MOUSE_UP)
+#define AC_MS_WD ACTION_MOUSE_WHEEL(MOUSE_DOWN)
 
 #ifdef KEYMAP_SECTION_ENABLE
 const action_t actionmaps[][UNIMAP_ROWS][UNIMAP_COLS] __attribute__ ((section (".keymap.keymaps"))) = {
@@ -28,7 +57,14 @@ const action_t actionmaps[][UNIMAP_ROWS][UNIMAP_COLS] PROGMEM = {
         ESC, F1,  F2,  F3,  F4,  F5,  F6,  F7,  F8,  F9,  F10, F11, F12, F13,   PSCR,SLCK,PAUS,       VOLD,VOLU,MUTE,  RCTL, F19,
         GRV, 1,   2,   3,   4,   5,   6,   7,   8,   9,   0,   MINS,EQL, BSPC,  END, DEL,        NLCK,PSLS,                  F20,
         TAB, Q,   W,   E,   R,   T,   Y,   U,   I,   O,   P,   LBRC,RBRC,       HOME,PGUP,       P7,  P8,  P9,  PPLS,        F21,
-        CAPS,A,   S,   D,   F,   G,   H,   J,   K,   L,   SCLN,QUOT,NUHS,       ENT, PGDN,       P4,  P5,  P6,  NO,          F22,
+        CAPS,A,   S,   D,   F,   G,   H,   J,   K,   L,   SCLN,QUOT,NUHS,       ENT, PGDN,       P4,  P5,  P6,  MOUS,        F22,
         LSFT,NUBS,Z,   X,   C,   V,   B,   N,   M,   COMM,DOT, SLSH,            DOWN,UP,         P1,  P2,  P3,  PENT,        F23,
-        NO,       LCTL,               SPC,                     RALT,     NO,    LEFT,RGHT,       P0,  P00, PCMM,NO,          F24)
+        NO,       ET1,                SPC,                     ET2,      NO,    LEFT,RGHT,       P0,  P00, PCMM,NO,          F24),
+    [1] = UNIMAP_K7637(
+        TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,  TRNS,TRNS,TRNS,       TRNS,TRNS,TRNS,  TRNS,TRNS,
+        TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,  TRNS,TRNS,       TRNS,TRNS,                  TRNS,
+        TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,       TRNS,TRNS,       MS_7,MS_8,MS_9,MS_B2,       TRNS,
+        TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,       TRNS,TRNS,       MS_4,MS_B1,MS_6,TRNS,       TRNS,
+        TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,TRNS,            TRNS,TRNS,       MS_1,MS_2,MS_3,MS_B3,       TRNS,
+        TRNS,     TRNS,               TRNS,                    TRNS,     TRNS,  TRNS,TRNS,       MS_B1,MS_WD,MS_WU,TRNS,     TRNS)
 };